@@ -0,0 +1,257 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include "common.hpp"
+
+// heap allocation counters per frame phase, compiled in with ALLOC_TRACKING
+// (cmake -DALLOC_TRACKING=ON). Without it the phase scopes are empty and
+// operator new is the library's.
+//
+// Only the main thread moves the phase. Allocations on the job pool count
+// toward whatever phase the main thread is in, which is the phase that handed
+// them the work. Counting is a few relaxed atomic adds per new/delete.
+
+#ifndef ALLOC_TRACKING
+#define ALLOC_TRACKING 0
+#endif
+
+enum Alloc_Phase : uint8_t {
+    PHASE_OTHER,
+    PHASE_INPUT,
+    PHASE_FLOW_FIELD,
+    PHASE_SPAWN,
+    PHASE_TOWERS,
+    PHASE_BULLETS,
+    PHASE_ENEMIES,
+    PHASE_GUI,
+    PHASE_DRAW,
+    ALLOC_PHASE_MAX
+};
+
+static const char* ALLOC_PHASE_NAMES[ALLOC_PHASE_MAX] = {
+    "other", "input", "flow_field", "spawn", "towers", "bullets", "enemies", "gui", "draw",
+};
+
+// the Level arrays that grow with the wave
+enum Alloc_Container : uint8_t {
+    CONTAINER_ENEMIES,
+    CONTAINER_ENEMY_RECORDS,
+    CONTAINER_BULLETS,
+    CONTAINER_SPAWNERS,
+    ALLOC_CONTAINER_MAX
+};
+
+static const char* ALLOC_CONTAINER_NAMES[ALLOC_CONTAINER_MAX] = {
+    "enemies", "enemy_records", "bullets", "spawners",
+};
+
+struct AllocCounters {
+    u64 allocations = 0;
+    u64 frees = 0;
+    u64 bytes = 0;
+};
+
+struct AllocFrame {
+    u64 frame = 0;
+    AllocCounters phases[ALLOC_PHASE_MAX];
+    // capacity in bytes at the end of the frame
+    u64 containers[ALLOC_CONTAINER_MAX] = {};
+};
+
+// set on the thread that owns the phase, see claim_phases
+static thread_local bool alloc_phase_owner = false;
+
+struct AllocTracker {
+    static constexpr u64 HISTORY = 1024;
+
+    std::atomic<uint8_t> phase = PHASE_OTHER;
+    std::atomic<u64> allocations[ALLOC_PHASE_MAX] = {};
+    std::atomic<u64> frees[ALLOC_PHASE_MAX] = {};
+    std::atomic<u64> bytes[ALLOC_PHASE_MAX] = {};
+    // since start, never reset
+    std::atomic<u64> total_allocations = 0;
+    std::atomic<u64> total_bytes = 0;
+
+    // main thread only from here on. The history is fixed size so recording a
+    // frame never allocates itself
+    u64 container_bytes[ALLOC_CONTAINER_MAX] = {};
+    u64 container_peak[ALLOC_CONTAINER_MAX] = {};
+    AllocFrame history[HISTORY];
+    u64 frame_count = 0;
+
+    void note_allocation(size_t size) {
+        uint8_t current = phase.load(std::memory_order_relaxed);
+        allocations[current].fetch_add(1, std::memory_order_relaxed);
+        bytes[current].fetch_add(size, std::memory_order_relaxed);
+        total_allocations.fetch_add(1, std::memory_order_relaxed);
+        total_bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+
+    void note_free() {
+        frees[phase.load(std::memory_order_relaxed)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // the calling thread becomes the one whose phase scopes count
+    void claim_phases() { alloc_phase_owner = true; }
+
+    Alloc_Phase set_phase(Alloc_Phase next) {
+        return (Alloc_Phase)phase.exchange(next, std::memory_order_relaxed);
+    }
+
+    // ignored off the phase owner, levels ticking on the pool would race
+    void note_container(Alloc_Container container, u64 capacity_bytes) {
+        if (!alloc_phase_owner) return;
+        container_bytes[container] = capacity_bytes;
+        container_peak[container] = std::max(container_peak[container], capacity_bytes);
+    }
+
+    // moves this frame's counters into the history
+    void end_frame();
+
+    bool empty() const { return frame_count == 0; }
+
+    // only valid when !empty()
+    const AllocFrame& get_last_frame() const { return history[(frame_count - 1) % HISTORY]; }
+
+    // most allocations any recorded frame made in phase
+    u64 get_peak_allocations(Alloc_Phase phase) const;
+
+    // one row per recorded frame, oldest first
+    bool write_csv(const char* file_name) const;
+};
+
+// constant initialized, safe to use from operator new during static init
+AllocTracker& alloc_tracker() {
+    static AllocTracker tracker;
+    return tracker;
+}
+
+// phase for the rest of the scope, restores the previous one after
+struct AllocPhaseScope {
+#if ALLOC_TRACKING
+    Alloc_Phase previous = PHASE_OTHER;
+    bool owner = false;
+
+    AllocPhaseScope(Alloc_Phase phase) : owner(alloc_phase_owner) {
+        if (owner) previous = alloc_tracker().set_phase(phase);
+    }
+
+    ~AllocPhaseScope() {
+        if (owner) alloc_tracker().set_phase(previous);
+    }
+#else
+    AllocPhaseScope(Alloc_Phase) {}
+#endif
+
+    AllocPhaseScope(const AllocPhaseScope&) = delete;
+    AllocPhaseScope& operator=(const AllocPhaseScope&) = delete;
+};
+
+void AllocTracker::end_frame() {
+    AllocFrame& frame = history[frame_count % HISTORY];
+    frame.frame = frame_count++;
+    for (int p = 0; p < ALLOC_PHASE_MAX; ++p) {
+        frame.phases[p].allocations = allocations[p].exchange(0, std::memory_order_relaxed);
+        frame.phases[p].frees = frees[p].exchange(0, std::memory_order_relaxed);
+        frame.phases[p].bytes = bytes[p].exchange(0, std::memory_order_relaxed);
+    }
+    for (int c = 0; c < ALLOC_CONTAINER_MAX; ++c) frame.containers[c] = container_bytes[c];
+}
+
+u64 AllocTracker::get_peak_allocations(Alloc_Phase phase) const {
+    u64 peak = 0;
+    u64 count = std::min(frame_count, HISTORY);
+    for (u64 i = 0; i < count; ++i) peak = std::max(peak, history[i].phases[phase].allocations);
+    return peak;
+}
+
+bool AllocTracker::write_csv(const char* file_name) const {
+    FILE* file = fopen(file_name, "w");
+    if (!file) return false;
+    fprintf(file, "frame");
+    for (int p = 0; p < ALLOC_PHASE_MAX; ++p) {
+        const char* name = ALLOC_PHASE_NAMES[p];
+        fprintf(file, ",%s_allocations,%s_frees,%s_bytes", name, name, name);
+    }
+    for (int c = 0; c < ALLOC_CONTAINER_MAX; ++c) fprintf(file, ",%s_bytes", ALLOC_CONTAINER_NAMES[c]);
+    fprintf(file, "\n");
+
+    u64 first = frame_count > HISTORY ? frame_count - HISTORY : 0;
+    for (u64 i = first; i < frame_count; ++i) {
+        const AllocFrame& frame = history[i % HISTORY];
+        fprintf(file, "%llu", (unsigned long long)frame.frame);
+        for (const AllocCounters& counters : frame.phases) {
+            fprintf(file, ",%llu,%llu,%llu", (unsigned long long)counters.allocations,
+                    (unsigned long long)counters.frees, (unsigned long long)counters.bytes);
+        }
+        for (u64 bytes : frame.containers) fprintf(file, ",%llu", (unsigned long long)bytes);
+        fprintf(file, "\n");
+    }
+    fclose(file);
+    return true;
+}
+
+#if ALLOC_TRACKING
+// every executable is a single translation unit, so this header is the one
+// place defining the replacements. All of them: the library's aligned and
+// nothrow forms don't go through the plain ones, and alignas(64) types like
+// Level and LogSlot take the aligned path
+static void* tracked_alloc(size_t size, size_t alignment) {
+    alloc_tracker().note_allocation(size);
+    if (size == 0) size = 1;
+    if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) return malloc(size);
+#if defined(_WIN32)
+    return _aligned_malloc(size, alignment);
+#else
+    void* ptr = nullptr;
+    return posix_memalign(&ptr, alignment, size) == 0 ? ptr : nullptr;
+#endif
+}
+
+static void tracked_free(void* ptr, size_t alignment) {
+    if (!ptr) return;
+    alloc_tracker().note_free();
+#if defined(_WIN32)
+    if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+        _aligned_free(ptr);
+        return;
+    }
+#endif
+    free(ptr);
+}
+
+static void* tracked_new(size_t size, size_t alignment) {
+    void* ptr = tracked_alloc(size, alignment);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+constexpr size_t PLAIN_ALIGNMENT = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+void* operator new(size_t size) { return tracked_new(size, PLAIN_ALIGNMENT); }
+void* operator new[](size_t size) { return tracked_new(size, PLAIN_ALIGNMENT); }
+void* operator new(size_t size, std::align_val_t al) { return tracked_new(size, (size_t)al); }
+void* operator new[](size_t size, std::align_val_t al) { return tracked_new(size, (size_t)al); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return tracked_alloc(size, PLAIN_ALIGNMENT); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return tracked_alloc(size, PLAIN_ALIGNMENT); }
+void* operator new(size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return tracked_alloc(size, (size_t)al); }
+void* operator new[](size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return tracked_alloc(size, (size_t)al); }
+
+void operator delete(void* ptr) noexcept { tracked_free(ptr, PLAIN_ALIGNMENT); }
+void operator delete[](void* ptr) noexcept { tracked_free(ptr, PLAIN_ALIGNMENT); }
+void operator delete(void* ptr, size_t) noexcept { tracked_free(ptr, PLAIN_ALIGNMENT); }
+void operator delete[](void* ptr, size_t) noexcept { tracked_free(ptr, PLAIN_ALIGNMENT); }
+void operator delete(void* ptr, std::align_val_t al) noexcept { tracked_free(ptr, (size_t)al); }
+void operator delete[](void* ptr, std::align_val_t al) noexcept { tracked_free(ptr, (size_t)al); }
+void operator delete(void* ptr, size_t, std::align_val_t al) noexcept { tracked_free(ptr, (size_t)al); }
+void operator delete[](void* ptr, size_t, std::align_val_t al) noexcept { tracked_free(ptr, (size_t)al); }
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { tracked_free(ptr, PLAIN_ALIGNMENT); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { tracked_free(ptr, PLAIN_ALIGNMENT); }
+void operator delete(void* ptr, std::align_val_t al, const std::nothrow_t&) noexcept { tracked_free(ptr, (size_t)al); }
+void operator delete[](void* ptr, std::align_val_t al, const std::nothrow_t&) noexcept { tracked_free(ptr, (size_t)al); }
+#endif
@@ -0,0 +1,283 @@
+#pragma once
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include "common.hpp"
+#include "game.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+// saves the level being played every interval seconds without stalling the
+// frame. The main thread only copies the sections the level marked dirty,
+// the job pool serializes them and writes the file. The file has the layout
+// of Level::save_to_file, so Level::from_file loads it: it is kept as one
+// blob per piece of that layout, only the pieces of dirty sections are
+// serialized again and the rest is written from the cached bytes. The new
+// file goes to a temp file that is renamed over the old one, a crash
+// mid-save leaves the previous autosave.
+struct Autosave {
+    // pieces of the save file, in file order
+    enum Chunk : uint8_t {
+        // magic and version
+        CHUNK_HEADER,
+        CHUNK_MAP,
+        // enemies and records
+        CHUNK_ENEMIES,
+        CHUNK_TOWERS,
+        CHUNK_SPAWNERS,
+        CHUNK_BULLETS,
+        CHUNK_ROUNDS,
+        // name, time and counters, a few bytes, written every save
+        CHUNK_TAIL,
+        CHUNK_MAX
+    };
+
+    static constexpr uint8_t CHUNK_SECTIONS[CHUNK_MAX] = {
+        ALL_SECTIONS,
+        section_bit(SECTION_MAP),
+        section_bit(SECTION_ENTITIES),
+        section_bit(SECTION_TOWERS),
+        section_bit(SECTION_SPAWNERS),
+        section_bit(SECTION_ENTITIES),
+        section_bit(SECTION_ROUNDS),
+        ALL_SECTIONS,
+    };
+
+    // what the job serializes, copied from the level section by section.
+    // Kept between saves so the copies reuse their storage
+    struct Snapshot {
+        std::shared_ptr<const Map> map;
+        std::vector<Enemy> enemies;
+        std::vector<EnemyRecord> enemy_records;
+        std::vector<Tower> towers;
+        SpawnScheduler scheduler;
+        std::vector<Projectile> bullets;
+        std::vector<Round> rounds;
+        std::string name;
+        float time = 0.f;
+        int active_round = -1;
+        u32 object_id_counter = 0;
+    };
+
+    std::string file_name;
+    std::string temp_name;
+    float interval = 5.f;
+    float since_save = 0.f;
+
+    // level the cached chunks belong to, another one starts from scratch
+    const Level* source = nullptr;
+    // the job owns snapshot and chunks while this is set
+    std::atomic<bool> saving = false;
+    Snapshot snapshot;
+    // sections the running or next job serializes
+    uint8_t sections = 0;
+    std::vector<byte> chunks[CHUNK_MAX];
+
+    // stats of the last finished save, for the bench and the log
+    u64 saves = 0;
+    size_t serialized_bytes = 0;
+    size_t file_bytes = 0;
+
+    Autosave(std::string file_name, float interval = 5.f);
+    ~Autosave();
+
+    Autosave(const Autosave&) = delete;
+    Autosave& operator=(const Autosave&) = delete;
+
+    // counts down and saves level when the interval is up and something
+    // changed. Call from the main thread while the level isn't ticking
+    void update(Level& level, float dt);
+
+    // snapshots the dirty sections of level and starts writing them, false
+    // while the last save is still running. The dirty bits stay set then and
+    // the next call picks them up
+    bool save(Level& level);
+
+    void wait();
+
+    // on the job pool
+    void write();
+
+    void serialize_chunk(Chunk chunk);
+
+    size_t get_chunk_byte_size(Chunk chunk) const;
+};
+
+Autosave::Autosave(std::string file_name, float interval)
+    : file_name(std::move(file_name)), interval(interval) {
+    temp_name = this->file_name + ".tmp";
+    // statics die in reverse order, the pool has to outlive our job
+    job_pool();
+}
+
+Autosave::~Autosave() {
+    wait();
+}
+
+void Autosave::wait() {
+    while (saving.load()) std::this_thread::yield();
+}
+
+void Autosave::update(Level& level, float dt) {
+    since_save += dt;
+    if (since_save < interval) return;
+    if (&level == source && level.dirty_sections == 0) return;
+    if (save(level)) since_save = 0.f;
+}
+
+bool Autosave::save(Level& level) {
+    if (saving.load()) return false;
+
+    if (&level != source) {
+        source = &level;
+        level.mark_dirty(ALL_SECTIONS);
+    }
+    sections = level.dirty_sections;
+    level.dirty_sections = 0;
+
+    if (sections & section_bit(SECTION_MAP)) snapshot.map = level.map;
+    if (sections & section_bit(SECTION_ENTITIES)) {
+        snapshot.enemies = level.enemies;
+        snapshot.enemy_records = level.enemy_records;
+        snapshot.bullets = level.bullets;
+    }
+    if (sections & section_bit(SECTION_TOWERS)) snapshot.towers = level.towers;
+    if (sections & section_bit(SECTION_SPAWNERS)) snapshot.scheduler = level.scheduler;
+    if (sections & section_bit(SECTION_ROUNDS)) snapshot.rounds = level.rounds;
+    snapshot.name = level.name;
+    snapshot.time = level.time;
+    snapshot.active_round = level.active_round;
+    snapshot.object_id_counter = level.object_id_counter;
+
+    saving.store(true);
+    job_pool().submit([this] {
+        write();
+        saving.store(false);
+    });
+    return true;
+}
+
+size_t Autosave::get_chunk_byte_size(Chunk chunk) const {
+    const Snapshot& s = snapshot;
+    size_t size = 0;
+    switch (chunk) {
+        case CHUNK_HEADER:
+            return LEVEL_FILE_HEADER_SIZE;
+        case CHUNK_MAP:
+            return s.map->get_byte_size();
+        case CHUNK_ENEMIES:
+            size += sizeof(size_t);
+            for (const Enemy& e : s.enemies) size += e.get_byte_size();
+            size += sizeof(size_t);
+            for (const EnemyRecord& er : s.enemy_records) size += er.get_byte_size();
+            return size;
+        case CHUNK_TOWERS:
+            size += sizeof(size_t);
+            for (const Tower& t : s.towers) size += t.get_byte_size();
+            return size;
+        case CHUNK_SPAWNERS:
+            return s.scheduler.get_byte_size();
+        case CHUNK_BULLETS:
+            size += sizeof(size_t);
+            for (const Projectile& p : s.bullets) size += p.get_byte_size();
+            return size;
+        case CHUNK_ROUNDS:
+            size += sizeof(size_t);
+            for (const Round& r : s.rounds) size += r.get_byte_size();
+            return size;
+        case CHUNK_TAIL:
+            return sizeof(size_t) + s.name.size() + sizeof(s.time) + sizeof(s.active_round) + sizeof(s.object_id_counter);
+        case CHUNK_MAX:
+            break;
+    }
+    return 0;
+}
+
+void Autosave::serialize_chunk(Chunk chunk) {
+    const Snapshot& s = snapshot;
+    std::vector<byte>& out = chunks[chunk];
+    out.resize(get_chunk_byte_size(chunk));
+    byte* blob = out.data();
+    size_t offset = 0;
+    switch (chunk) {
+        case CHUNK_HEADER:
+            write_to_blob(blob, offset, LEVEL_FILE_MAGIC);
+            write_to_blob(blob, offset, LEVEL_FILE_VERSION);
+            break;
+        case CHUNK_MAP:
+            s.map->save_to_blob(blob, offset);
+            break;
+        case CHUNK_ENEMIES:
+            struct_array_to_blob(blob, offset, s.enemies);
+            struct_array_to_blob(blob, offset, s.enemy_records);
+            break;
+        case CHUNK_TOWERS:
+            struct_array_to_blob(blob, offset, s.towers);
+            break;
+        case CHUNK_SPAWNERS:
+            s.scheduler.save_to_blob(blob, offset);
+            break;
+        case CHUNK_BULLETS:
+            struct_array_to_blob(blob, offset, s.bullets);
+            break;
+        case CHUNK_ROUNDS:
+            struct_array_to_blob(blob, offset, s.rounds);
+            break;
+        case CHUNK_TAIL:
+            string_to_blob(blob, offset, s.name);
+            write_to_blob(blob, offset, s.time);
+            write_to_blob(blob, offset, s.active_round);
+            write_to_blob(blob, offset, s.object_id_counter);
+            break;
+        case CHUNK_MAX:
+            break;
+    }
+    assert(offset == out.size());
+}
+
+void Autosave::write() {
+    serialized_bytes = 0;
+    file_bytes = 0;
+    for (u32 i = 0; i < CHUNK_MAX; ++i) {
+        if (sections & CHUNK_SECTIONS[i]) {
+            serialize_chunk((Chunk)i);
+            serialized_bytes += chunks[i].size();
+        }
+        file_bytes += chunks[i].size();
+    }
+    // the chunk has the map's bytes, no need to keep it from being edited in place
+    snapshot.map.reset();
+
+    FILE* file = fopen(temp_name.c_str(), "wb");
+    if (!file) {
+        log_low(LOG_IO, "autosave can't open {}", temp_name);
+        return;
+    }
+    bool ok = true;
+    for (const std::vector<byte>& chunk : chunks) {
+        if (!chunk.empty()) ok &= fwrite(chunk.data(), 1, chunk.size(), file) == chunk.size();
+    }
+    ok &= fflush(file) == 0;
+#if defined(__unix__) || defined(__APPLE__)
+    // the rename must not land before the data does
+    ok &= fsync(fileno(file)) == 0;
+#endif
+    ok &= fclose(file) == 0;
+
+    std::error_code error;
+    if (ok) std::filesystem::rename(temp_name, file_name, error);
+    if (!ok || error) {
+        log_low(LOG_IO, "autosave to {} failed, the last one stays", file_name);
+        std::filesystem::remove(temp_name, error);
+        return;
+    }
+    ++saves;
+    log_full(LOG_IO, "autosaved {}, {} of {} bytes serialized", file_name, serialized_bytes, file_bytes);
+}
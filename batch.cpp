@@ -0,0 +1,278 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <vector>
+#include "raylib.h"
+#include "common.hpp"
+#include "game.hpp"
+#include "jobs.hpp"
+
+// headless monte carlo runner, plays one level many times and writes
+// aggregate stats to csv
+
+struct BatchOptions {
+    const char* level_file = nullptr;
+    const char* out_file = "batch.csv";
+    const char* runs_file = nullptr;
+    u64 runs = 1000;
+    u32 threads = 0;
+    u64 seed = 1;
+    u64 random_towers = 0;
+    // per run noise on the rounds, so runs differ even without random towers
+    float start_jitter = 0.5f;
+    float delay_jitter = 0.1f;
+    Tower_Type tower_type = TOWER_SEEK;
+    float dt = 1.f / 60.f;
+    float max_time = 600.f;
+    Log_Level log_level = NO_LOG;
+};
+
+struct RunResult {
+    u64 seed = 0;
+    u64 leaked = 0;
+    u64 killed = 0;
+    float clear_time = -1.f;
+    u64 ticks = 0;
+    float hit_rate = 0.f;
+    float average_bullets = 0.f;
+    std::vector<u64> tower_kills;
+};
+
+void print_usage() {
+    printf("usage: tower_defense_batch <level.blob> [options]\n");
+    printf("  -n <runs>      simulations to run (1000)\n");
+    printf("  -j <threads>   worker threads, 0 = one per core (0)\n");
+    printf("  -s <seed>      base seed, run i uses seed + i (1)\n");
+    printf("  -t <towers>    random towers placed on top of the level's (0)\n");
+    printf("  -k <type>      type of the random towers, 0 = basic, 1 = seek, 2 = splash, 3 = aura (1)\n");
+    printf("  -v <seconds>   spawn events start up to this much earlier or later each run (0.5)\n");
+    printf("  -g <fraction>  time between the enemies of an event varies by up to this much (0.1)\n");
+    printf("  -d <dt>        fixed timestep in seconds (0.016667)\n");
+    printf("  -m <seconds>   give up on a run after this much level time (600)\n");
+    printf("  -o <file>      aggregate csv (batch.csv)\n");
+    printf("  -r <file>      also write one csv row per run\n");
+    printf("  -l <level>     log level of the runs, 0 = none, 1 = low, 2 = full (0)\n");
+}
+
+bool parse_options(int argc, char** argv, BatchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg[0] != '-') {
+            options.level_file = argv[i];
+            continue;
+        }
+        if (i + 1 >= argc) return false;
+        const char* value = argv[++i];
+        if (arg == "-n") options.runs = strtoull(value, nullptr, 10);
+        else if (arg == "-j") options.threads = strtoul(value, nullptr, 10);
+        else if (arg == "-s") options.seed = strtoull(value, nullptr, 10);
+        else if (arg == "-t") options.random_towers = strtoull(value, nullptr, 10);
+        else if (arg == "-k") options.tower_type = (Tower_Type)strtoul(value, nullptr, 10);
+        else if (arg == "-v") options.start_jitter = strtof(value, nullptr);
+        else if (arg == "-g") options.delay_jitter = strtof(value, nullptr);
+        else if (arg == "-d") options.dt = strtof(value, nullptr);
+        else if (arg == "-m") options.max_time = strtof(value, nullptr);
+        else if (arg == "-o") options.out_file = value;
+        else if (arg == "-r") options.runs_file = value;
+        else if (arg == "-l") options.log_level = (Log_Level)strtoul(value, nullptr, 10);
+        else return false;
+    }
+    return options.level_file && options.runs > 0 && options.dt > 0.f && options.start_jitter >= 0.f &&
+           options.delay_jitter >= 0.f && options.delay_jitter < 1.f;
+}
+
+// uniform in [-1, 1)
+static float signed_unit(Rng& rng) {
+    return rng.next_float() * 2.f - 1.f;
+}
+
+// moves every spawn event and stretches its delay a little, keeping the
+// rounds sorted by start
+void jitter_rounds(Level& level, Rng& rng, float start_jitter, float delay_jitter) {
+    for (Round& round : level.rounds) {
+        for (SpawnEvent& event : round.events) {
+            event.start = std::max(0.f, event.start + signed_unit(rng) * start_jitter);
+            event.delay *= 1.f + signed_unit(rng) * delay_jitter;
+        }
+        std::stable_sort(round.events.begin(), round.events.end(),
+                         [](const SpawnEvent& a, const SpawnEvent& b) { return a.start < b.start; });
+    }
+}
+
+// local towers, every run keeps sharing the base level's map
+void place_random_towers(Level& level, Rng& rng, u64 count, Tower_Type type) {
+    Rectangle bounds = level.get_bounds();
+    // give up on a tower after a few tries on crowded maps
+    for (u64 i = 0; i < count; ++i) {
+        for (int attempt = 0; attempt < 16; ++attempt) {
+            Tower tower;
+            tower.type = type;
+            tower.position = {rng.next_float() * (bounds.width - tower.size.x), rng.next_float() * (bounds.height - tower.size.y)};
+            if (level.check_free(to_rec(tower.position, tower.size))) {
+                level.add_local_tower(tower);
+                break;
+            }
+        }
+    }
+}
+
+RunResult run_simulation(const Level& base, const BatchOptions& options, u64 seed) {
+    RunResult result;
+    result.seed = seed;
+
+    Level level = base.fork();
+    Rng rng(seed);
+    jitter_rounds(level, rng, options.start_jitter, options.delay_jitter);
+    place_random_towers(level, rng, options.random_towers, options.tower_type);
+    level.update_flow_field(true);
+
+    Rectangle bounds = level.get_bounds();
+    level.start();
+    while (level.stats.clear_time < 0.f && level.time < options.max_time) {
+        level.update(bounds, options.dt);
+        result.ticks++;
+    }
+
+    result.leaked = level.stats.leaked;
+    result.killed = level.stats.killed;
+    result.clear_time = level.stats.clear_time;
+    result.hit_rate = level.stats.hit_rate();
+    result.average_bullets = level.stats.average_bullets();
+    result.tower_kills = level.stats.tower_kills;
+    return result;
+}
+
+struct Aggregate {
+    double sum = 0.0;
+    double sum_sq = 0.0;
+    double min = INFINITY;
+    double max = -INFINITY;
+    u64 count = 0;
+
+    void add(double value) {
+        sum += value;
+        sum_sq += value * value;
+        min = std::min(min, value);
+        max = std::max(max, value);
+        count++;
+    }
+
+    double mean() const { return count ? sum / count : 0.0; }
+
+    double stddev() const {
+        if (count < 2) return 0.0;
+        double m = mean();
+        return std::sqrt(std::max(0.0, sum_sq / count - m * m));
+    }
+
+    void write_row(FILE* file, const char* name) const {
+        if (count == 0) {
+            fprintf(file, "%s,0,,,,\n", name);
+            return;
+        }
+        fprintf(file, "%s,%d,%f,%f,%f,%f\n", name, (int)count, mean(), stddev(), min, max);
+    }
+};
+
+bool write_aggregate(const char* file_name, const std::vector<RunResult>& results, u64 base_towers) {
+    FILE* file = fopen(file_name, "w");
+    if (!file) return false;
+
+    Aggregate leaked, killed, clear_time, ticks, cleared, hit_rate, bullets;
+    std::vector<Aggregate> tower_kills(base_towers);
+    for (const RunResult& result : results) {
+        leaked.add(result.leaked);
+        killed.add(result.killed);
+        ticks.add(result.ticks);
+        hit_rate.add(result.hit_rate);
+        bullets.add(result.average_bullets);
+        cleared.add(result.clear_time >= 0.f ? 1.0 : 0.0);
+        if (result.clear_time >= 0.f) clear_time.add(result.clear_time);
+        // random towers differ per run, only the level's own get a column
+        for (u64 i = 0; i < base_towers && i < result.tower_kills.size(); ++i) {
+            tower_kills[i].add(result.tower_kills[i]);
+        }
+    }
+
+    fprintf(file, "stat,runs,mean,stddev,min,max\n");
+    leaked.write_row(file, "leaked");
+    killed.write_row(file, "killed");
+    cleared.write_row(file, "cleared");
+    clear_time.write_row(file, "clear_time");
+    ticks.write_row(file, "ticks");
+    hit_rate.write_row(file, "hit_rate");
+    bullets.write_row(file, "live_bullets");
+    for (u64 i = 0; i < tower_kills.size(); ++i) {
+        std::string name = "tower_" + std::to_string(i) + "_kills";
+        tower_kills[i].write_row(file, name.c_str());
+    }
+    fclose(file);
+    return true;
+}
+
+bool write_runs(const char* file_name, const std::vector<RunResult>& results) {
+    FILE* file = fopen(file_name, "w");
+    if (!file) return false;
+    fprintf(file, "run,seed,leaked,killed,clear_time,ticks,hit_rate,live_bullets,tower_kills\n");
+    for (u64 i = 0; i < results.size(); ++i) {
+        const RunResult& result = results[i];
+        fprintf(file, "%d,%llu,%llu,%llu,%f,%llu,%f,%f,", (int)i, (unsigned long long)result.seed,
+                (unsigned long long)result.leaked, (unsigned long long)result.killed,
+                result.clear_time, (unsigned long long)result.ticks, result.hit_rate, result.average_bullets);
+        for (u64 t = 0; t < result.tower_kills.size(); ++t) {
+            fprintf(file, t == 0 ? "%llu" : ";%llu", (unsigned long long)result.tower_kills[t]);
+        }
+        fprintf(file, "\n");
+    }
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    BatchOptions options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage();
+        return 1;
+    }
+    if (!FileExists(options.level_file)) {
+        std::cerr << "level file not found: " << options.level_file << "\n";
+        return 1;
+    }
+
+    logger().set_level(options.log_level);
+
+    std::optional<Level> loaded = Level::from_file(options.level_file);
+    if (!loaded) {
+        std::cerr << "could not load level: " << options.level_file << "\n";
+        return 1;
+    }
+    // every run forks this one and shares its map
+    const Level& base = *loaded;
+
+    std::vector<RunResult> results(options.runs);
+    ThreadPool pool(options.threads);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    pool.parallel_for(options.runs, [&](u64 i) {
+        results[i] = run_simulation(base, options, options.seed + i);
+    });
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    u64 total_ticks = 0;
+    for (const RunResult& result : results) total_ticks += result.ticks;
+    printf("%d runs on %d threads in %.2f s, %.0f ticks/s\n", (int)options.runs, (int)pool.size(),
+           elapsed, total_ticks / elapsed);
+
+    if (!write_aggregate(options.out_file, results, base.towers.size())) {
+        std::cerr << "could not write " << options.out_file << "\n";
+        return 1;
+    }
+    if (options.runs_file && !write_runs(options.runs_file, results)) {
+        std::cerr << "could not write " << options.runs_file << "\n";
+        return 1;
+    }
+    return 0;
+}
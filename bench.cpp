@@ -0,0 +1,1093 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+// the allocation counts below come from the tracker
+#ifndef ALLOC_TRACKING
+#define ALLOC_TRACKING 1
+#endif
+#include "raylib.h"
+#include "common.hpp"
+#include "noise.hpp"
+#include "game.hpp"
+#include "flow_field.hpp"
+#include "autosave.hpp"
+#include "waves.hpp"
+
+// headless benchmarks, no window needed. Every number a benchmark reports is
+// named group/metric, can be written to json and compared against an older run
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// fastest of a few runs, setup runs before each one and isn't timed
+template<class Setup, class F>
+static double best_of(int repeats, Setup&& setup, F&& fn) {
+    double best = INFINITY;
+    for (int i = 0; i < repeats; ++i) {
+        setup();
+        Clock::time_point start = Clock::now();
+        fn();
+        best = std::min(best, seconds_since(start));
+    }
+    return best;
+}
+
+enum Bench_Better : uint8_t {
+    LOWER_BETTER,
+    HIGHER_BETTER,
+    // counts and sizes for context, never flagged
+    INFO_ONLY,
+};
+
+static const char* BENCH_BETTER_NAMES[] = {"lower", "higher", "none"};
+
+struct BenchResult {
+    std::string name;
+    double value = 0.0;
+    std::string unit;
+    Bench_Better better = LOWER_BETTER;
+};
+
+struct BenchSuite {
+    std::vector<BenchResult> results;
+    std::string group;
+
+    // starts a group of results, the description is only printed
+    void begin(const std::string& name, const std::string& description) {
+        group = name;
+        printf("%s: %s\n", name.c_str(), description.c_str());
+    }
+
+    // checks that must hold whatever the timings, main exits 1 if one fails
+    std::vector<std::string> failures;
+
+    void check(bool ok, const char* what) {
+        if (ok) return;
+        failures.push_back(group + ": " + what);
+        printf("  FAILED: %s\n", what);
+    }
+
+    void report(const char* metric, double value, const char* unit, Bench_Better better = LOWER_BETTER) {
+        BenchResult result;
+        result.name = group + "/" + metric;
+        result.value = value;
+        result.unit = unit;
+        result.better = better;
+        results.push_back(result);
+        printf("  %-22s %12.3f %s\n", metric, value, unit);
+    }
+
+    bool write_json(const char* file_name) const;
+};
+
+bool BenchSuite::write_json(const char* file_name) const {
+    FILE* file = fopen(file_name, "w");
+    if (!file) return false;
+    fprintf(file, "{\n  \"threads\": %u,\n  \"benchmarks\": [\n", job_pool().size());
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& result = results[i];
+        fprintf(file, "    {\"name\": \"%s\", \"value\": %.9g, \"unit\": \"%s\", \"better\": \"%s\"}%s\n",
+                result.name.c_str(), result.value, result.unit.c_str(), BENCH_BETTER_NAMES[result.better],
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    return true;
+}
+
+// reads back what write_json wrote, not a general json parser
+static bool find_json_string(const std::string& text, size_t from, size_t to, const char* key, std::string& out) {
+    size_t at = text.find(std::string("\"") + key + "\"", from);
+    if (at == std::string::npos || at >= to) return false;
+    size_t open = text.find('"', text.find(':', at) + 1);
+    size_t close = text.find('"', open + 1);
+    if (open == std::string::npos || close == std::string::npos || close >= to) return false;
+    out = text.substr(open + 1, close - open - 1);
+    return true;
+}
+
+static bool read_baseline(const char* file_name, std::vector<BenchResult>& results) {
+    std::ifstream file(file_name);
+    if (!file) return false;
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    std::string text = buffer.str();
+
+    size_t list = text.find("\"benchmarks\"");
+    if (list == std::string::npos) return false;
+    for (size_t open = text.find('{', list); open != std::string::npos; open = text.find('{', open + 1)) {
+        size_t close = text.find('}', open);
+        if (close == std::string::npos) return false;
+        BenchResult result;
+        std::string better;
+        size_t value = text.find("\"value\"", open);
+        if (!find_json_string(text, open, close, "name", result.name) || value == std::string::npos || value >= close) {
+            return false;
+        }
+        result.value = strtod(text.c_str() + text.find(':', value) + 1, nullptr);
+        find_json_string(text, open, close, "unit", result.unit);
+        if (find_json_string(text, open, close, "better", better)) {
+            for (int i = 0; i <= INFO_ONLY; ++i) {
+                if (better == BENCH_BETTER_NAMES[i]) result.better = (Bench_Better)i;
+            }
+        }
+        results.push_back(result);
+    }
+    return true;
+}
+
+// prints current vs baseline for every metric, returns how many got worse by
+// more than threshold (0.1 = 10%)
+static int compare_results(const std::vector<BenchResult>& current, const std::vector<BenchResult>& baseline, double threshold) {
+    int regressions = 0;
+    printf("\n%-44s %12s %12s %8s\n", "benchmark", "baseline", "current", "change");
+    for (const BenchResult& result : current) {
+        const BenchResult* base = nullptr;
+        for (const BenchResult& b : baseline) {
+            if (b.name == result.name) base = &b;
+        }
+        if (!base) {
+            printf("%-44s %12s %12.3f %8s  new\n", result.name.c_str(), "-", result.value, "");
+            continue;
+        }
+        double change = base->value != 0.0 ? (result.value - base->value) / fabs(base->value) : 0.0;
+        bool regressed = (result.better == LOWER_BETTER && change > threshold) ||
+                         (result.better == HIGHER_BETTER && change < -threshold);
+        bool improved = (result.better == LOWER_BETTER && change < -threshold) ||
+                        (result.better == HIGHER_BETTER && change > threshold);
+        if (regressed) regressions++;
+        printf("%-44s %12.3f %12.3f %+7.1f%%%s\n", result.name.c_str(), base->value, result.value, change * 100.0,
+               regressed ? "  REGRESSION" : improved ? "  better" : "");
+    }
+    printf("%d regression%s over %.0f%%\n", regressions, regressions == 1 ? "" : "s", threshold * 100.0);
+    return regressions;
+}
+
+void bench_noise(BenchSuite& suite, int width, int height, int iterations) {
+    suite.begin("noise", TextFormat("%dx%d, %d octaves", width, height, NoiseParams().octaves));
+    u32 max_threads = std::max(1u, std::thread::hardware_concurrency());
+    NoiseParams params;
+    params.seed = 1234;
+    std::vector<u32> thread_counts;
+    for (u32 threads = 1; threads < max_threads; threads *= 2) thread_counts.push_back(threads);
+    thread_counts.push_back(max_threads);
+
+    for (u32 threads : thread_counts) {
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            Image img = gen_noise_image(width, height, params, threads);
+            UnloadImage(img);
+        }
+        double elapsed = seconds_since(start);
+        double mpix = (double)width * height * iterations / 1e6;
+        suite.report(TextFormat("threads_%u", threads), mpix / elapsed, "Mpix/s", HIGHER_BETTER);
+    }
+}
+
+// tile generation per lod, and how many tiles views of a 16k map need at the
+// worst zoom of every lod
+void bench_ground_tiles(BenchSuite& suite, int iterations) {
+    suite.begin("ground_tiles", TextFormat("%dx%d tiles, 1920x1080 view", GroundTiles::TILE_SIZE, GroundTiles::TILE_SIZE));
+    NoiseParams params;
+    params.seed = 1234;
+    for (int lod : {0, 3, 6}) {
+        float scale = (float)(1 << lod);
+        double seconds = best_of(3, [] {}, [&] {
+            for (int i = 0; i < iterations; ++i) {
+                Image img = gen_noise_tile(i * GroundTiles::get_span(lod), 0.f, GroundTiles::TILE_SIZE, scale, params);
+                UnloadImage(img);
+            }
+        });
+        suite.report(TextFormat("lod_%d_generate", lod), seconds * 1000.0 / iterations, "ms/tile", LOWER_BETTER);
+    }
+
+    const float map_size = 16384.f;
+    u32 most_tiles = 0;
+    for (float zoom = 1.f; zoom >= 1080.f / map_size; zoom *= 0.98f) {
+        float span = GroundTiles::get_span(GroundTiles::lod_for_zoom(zoom));
+        // worst case alignment, a partial tile on both sides
+        u32 columns = (u32)std::min(ceilf(map_size / span), ceilf(1920.f / zoom / span) + 1.f);
+        u32 rows = (u32)std::min(ceilf(map_size / span), ceilf(1080.f / zoom / span) + 1.f);
+        most_tiles = std::max(most_tiles, columns * rows);
+    }
+    suite.report("most_tiles_in_view", most_tiles, "tiles", INFO_ONLY);
+    suite.check(most_tiles <= ground_tiles().budget, "a view of a 16k map fits in the tile budget");
+}
+
+Level make_large_level(u64 seed, u64 waypoint_count, u64 tower_count, u64 enemy_count) {
+    Rng rng(seed);
+    Level level("bench", {0.f, 0.f, 4096.f, 4096.f});
+    Map& map = level.edit_map();
+    map.ground_seed = seed;
+    for (u64 i = 0; i < waypoint_count; ++i) {
+        map.waypoints.push_back({rng.next_float() * 4096.f, rng.next_float() * 4096.f});
+    }
+    for (u64 i = 0; i < tower_count; ++i) {
+        Tower tower;
+        tower.position = {rng.next_float() * 4096.f, rng.next_float() * 4096.f};
+        level.add_tower(tower);
+    }
+    for (u64 i = 0; i < enemy_count; ++i) {
+        Enemy enemy;
+        enemy.set_position({rng.next_float() * 4096.f, rng.next_float() * 4096.f});
+        level.add_enemy(enemy);
+    }
+    Round round;
+    round.length = 100.f;
+    SpawnEvent event = {};
+    event.delay = 0.5f;
+    event.enemies[CHICKEN] = 100;
+    for (int i = 0; i < 10; ++i) {
+        event.start = (float)i;
+        round.events.push_back(event);
+    }
+    level.rounds.push_back(round);
+    return level;
+}
+
+static Projectile random_bullet(Rng& rng, Projectile_Type type) {
+    Projectile bullet;
+    bullet.type = type;
+    bullet.position = {rng.next_float() * 4096.f, rng.next_float() * 4096.f};
+    float angle = rng.next_float() * 2.f * PI;
+    bullet.direction = {cosf(angle), sinf(angle)};
+    return bullet;
+}
+
+// every non empty array of a level should cost exactly one allocation on load
+void bench_campaign_load(BenchSuite& suite, u64 level_count) {
+    suite.begin("campaign_load", TextFormat("%d levels", (int)level_count));
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "tower_defense_bench";
+    std::filesystem::create_directories(dir);
+
+    std::vector<std::string> files;
+    for (u64 i = 0; i < level_count; ++i) {
+        Level level = make_large_level(i, 10000, 1000, 10000);
+        files.push_back((dir / ("level_" + std::to_string(i) + ".blob")).string());
+        level.save_to_file(files.back().c_str());
+    }
+
+    Game game;
+    u64 allocations_before = alloc_tracker().total_allocations.load();
+    Clock::time_point start = Clock::now();
+    game.load_levels(files);
+    double elapsed = seconds_since(start);
+    u64 allocations = alloc_tracker().total_allocations.load() - allocations_before;
+
+    suite.report("load", elapsed * 1000.0, "ms");
+    suite.report("allocations", (double)allocations / level_count, "per level");
+
+    for (const std::string& file : files) std::filesystem::remove(file);
+}
+
+// only the round and spawner update, enemies never move
+void bench_spawn_round(BenchSuite& suite, u64 event_count, u64 enemies_per_event) {
+    suite.begin("spawn_round", TextFormat("%d enemies in %d events", (int)(event_count * enemies_per_event), (int)event_count));
+    Level level("bench", {0.f, 0.f, 1200.f, 900.f});
+    Round round;
+    round.length = 1000.f;
+    for (u64 i = 0; i < event_count; ++i) {
+        SpawnEvent event = {};
+        event.start = (float)i * 0.1f;
+        event.delay = 0.5f;
+        event.enemies[CHICKEN] = enemies_per_event;
+        event.position = {600.f, 450.f};
+        round.events.push_back(event);
+    }
+    level.rounds.push_back(round);
+    level.start();
+
+    const float dt = 1.f / 60.f;
+    u64 ticks = 0;
+    size_t peak_spawners = 0;
+    Clock::time_point start = Clock::now();
+    while (level.enemies.size() < event_count * enemies_per_event) {
+        level.time += dt;
+        level.update_round(dt);
+        level.update_spawners();
+        peak_spawners = std::max(peak_spawners, level.scheduler.size());
+        ticks++;
+    }
+    double elapsed = seconds_since(start);
+    suite.report("tick", elapsed * 1e6 / ticks, "us");
+    suite.report("spawn", elapsed * 1e9 / level.enemies.size(), "ns/enemy");
+    suite.report("peak_spawners", (double)peak_spawners, "spawners", INFO_ONLY);
+}
+
+void bench_burst_spawn(BenchSuite& suite, u64 count, int iterations) {
+    suite.begin("burst_spawn", TextFormat("%d enemies in one tick", (int)count));
+    double single = 0.0;
+    double batch = 0.0;
+    for (int i = 0; i < iterations; ++i) {
+        Level level("bench", {0.f, 0.f, 1200.f, 900.f});
+        Clock::time_point start = Clock::now();
+        for (u64 e = 0; e < count; ++e) {
+            Enemy enemy;
+            enemy.set_position({600.f, 450.f});
+            level.add_enemy(enemy);
+        }
+        single += seconds_since(start);
+
+        Level burst_level("bench", {0.f, 0.f, 1200.f, 900.f});
+        SpawnEvent event = {};
+        event.delay = 0.f;
+        event.enemies[CHICKEN] = count;
+        event.position = {600.f, 450.f};
+        start = Clock::now();
+        event.spawn(burst_level);
+        batch += seconds_since(start);
+        assert(burst_level.enemies.size() == count);
+    }
+    suite.report("add_enemy", single * 1e6 / iterations, "us");
+    suite.report("add_enemies", batch * 1e6 / iterations, "us");
+}
+
+void bench_flow_field(BenchSuite& suite, u32 size, int updates) {
+    suite.begin("flow_field", TextFormat("%ux%u", size, size));
+    const float cell = 8.f;
+    Rng rng(42);
+    FlowField field;
+    field.init(size * cell, size * cell, cell);
+    std::vector<u32> changed;
+    for (int i = 0; i < 2000; ++i) {
+        field.set_blocked({rng.next_float() * size * cell, rng.next_float() * size * cell, 16.f, 16.f}, true, changed);
+    }
+
+    Clock::time_point start = Clock::now();
+    field.compute({size * cell - 1.f, size * cell - 1.f});
+    double full = seconds_since(start);
+
+    double incremental = 0.0;
+    std::vector<Rectangle> towers;
+    for (int i = 0; i < updates; ++i) {
+        Rectangle tower = {rng.next_float() * size * cell, rng.next_float() * size * cell, 16.f, 16.f};
+        towers.push_back(tower);
+        changed.clear();
+        start = Clock::now();
+        field.set_blocked(tower, true, changed);
+        field.repair(changed);
+        incremental += seconds_since(start);
+    }
+    double removal = 0.0;
+    for (const Rectangle& tower : towers) {
+        changed.clear();
+        start = Clock::now();
+        field.set_blocked(tower, false, changed);
+        field.repair(changed);
+        removal += seconds_since(start);
+    }
+    suite.report("full", full * 1000.0, "ms");
+    suite.report("place", incremental * 1e6 / updates, "us/tower");
+    suite.report("remove", removal * 1e6 / updates, "us/tower");
+}
+
+// targeting alone, once with every tower searching the grid and once with
+// every tower already locked on
+void bench_tower_update(BenchSuite& suite, u64 tower_count, u64 enemy_count) {
+    suite.begin("tower_update", TextFormat("%d towers, %d enemies", (int)tower_count, (int)enemy_count));
+    Level level = make_large_level(5, 10, tower_count, enemy_count);
+    level.build_enemy_grid();
+    const float dt = 1.f / 60.f;
+    auto update = [&]() {
+        for (Tower& tower : level.towers) tower.update(level.enemies, level.enemy_records, level.enemy_grid, dt);
+    };
+
+    std::vector<Tower> idle = level.towers;
+    double acquire = best_of(5, [&]() { level.towers = idle; }, update);
+    std::vector<Tower> locked = level.towers;
+    double track = best_of(5, [&]() { level.towers = locked; }, update);
+
+    u64 lock_count = 0;
+    for (const Tower& tower : locked) lock_count += tower.target_lock;
+    suite.report("acquire", acquire * 1e9 / tower_count, "ns/tower");
+    suite.report("track", track * 1e9 / tower_count, "ns/tower");
+    suite.report("locked", (double)lock_count, "towers", INFO_ONLY);
+}
+
+// one step of every bullet against the grid, per archetype
+void bench_projectile_update(BenchSuite& suite, u64 bullet_count, u64 enemy_count) {
+    suite.begin("projectile_update", TextFormat("%d bullets, %d enemies", (int)bullet_count, (int)enemy_count));
+    static const char* names[PROJECTILE_TYPE_MAX] = {"straight", "seek", "splash"};
+    Level level = make_large_level(7, 10, 0, enemy_count);
+    level.build_enemy_grid();
+    Rectangle bounds = level.get_bounds();
+    const float dt = 1.f / 60.f;
+    std::vector<DamageEvent> events;
+
+    for (int type = 0; type < PROJECTILE_TYPE_MAX; ++type) {
+        Rng rng(7);
+        std::vector<Projectile> bullets(bullet_count);
+        for (Projectile& bullet : bullets) {
+            bullet = random_bullet(rng, (Projectile_Type)type);
+            bullet.target_id = level.enemies[rng.range(0, (int)enemy_count - 1)].id;
+        }
+        u64 hits = 0;
+        double elapsed = best_of(5, [&]() { level.bullets = bullets; events.clear(); hits = 0; }, [&]() {
+            for (Projectile& bullet : level.bullets) {
+                hits += bullet.update(level.enemies, level.enemy_records, level.enemy_grid, bounds, dt, events);
+            }
+        });
+        suite.report(names[type], elapsed * 1e9 / bullet_count, "ns/bullet");
+        suite.report((std::string(names[type]) + "_hits").c_str(), (double)hits, "hits", INFO_ONLY);
+    }
+}
+
+// one step of every enemy, along the waypoints and on a flow field
+void bench_enemy_update(BenchSuite& suite, u64 enemy_count) {
+    suite.begin("enemy_update", TextFormat("%d enemies", (int)enemy_count));
+    Level level = make_large_level(9, 50, 0, enemy_count);
+    Rng rng(9);
+    for (Enemy& enemy : level.enemies) enemy.next_waypoint = rng.range(0, 49);
+    const float dt = 1.f / 60.f;
+    std::vector<Enemy> enemies = level.enemies;
+    auto update = [&]() {
+        for (Enemy& enemy : level.enemies) enemy.update(*level.map, level.get_flow_field(), dt);
+    };
+
+    double path = best_of(5, [&]() { level.enemies = enemies; }, update);
+    suite.report("path", path * 1e9 / enemy_count, "ns/enemy");
+
+    Map& map = level.edit_map();
+    map.use_flow_field = true;
+    map.build_flow_field();
+    double flow = best_of(5, [&]() { level.enemies = enemies; }, update);
+    suite.report("flow", flow * 1e9 / enemy_count, "ns/enemy");
+}
+
+template<class T>
+static double time_remove_inactive(const std::vector<T>& array, Rng& rng, float inactive_share) {
+    std::vector<T> scratch;
+    return best_of(5, [&]() {
+        scratch = array;
+        for (T& element : scratch) element.active = rng.next_float() >= inactive_share;
+    }, [&]() { remove_inactive_elements(scratch); });
+}
+
+void bench_remove_inactive(BenchSuite& suite, u64 count) {
+    suite.begin("remove_inactive", TextFormat("%d elements", (int)count));
+    Rng rng(21);
+    std::vector<Enemy> enemies(count);
+    std::vector<Projectile> bullets(count);
+    suite.report("enemies_1pct", time_remove_inactive(enemies, rng, 0.01f) * 1e9 / count, "ns/element");
+    suite.report("enemies_10pct", time_remove_inactive(enemies, rng, 0.1f) * 1e9 / count, "ns/element");
+    suite.report("bullets_10pct", time_remove_inactive(bullets, rng, 0.1f) * 1e9 / count, "ns/element");
+    suite.report("bullets_50pct", time_remove_inactive(bullets, rng, 0.5f) * 1e9 / count, "ns/element");
+}
+
+// tower placement test against a crowded map
+void bench_check_free(BenchSuite& suite, u64 area_count, u64 query_count) {
+    suite.begin("check_free", TextFormat("%d occupied areas", (int)area_count));
+    Rng rng(23);
+    Map map({0.f, 0.f, 4096.f, 4096.f});
+    for (u64 i = 0; i < area_count; ++i) {
+        map.occupied_areas.push_back({rng.next_float() * 4096.f, rng.next_float() * 4096.f, 16.f, 16.f});
+    }
+    std::vector<Rectangle> queries(query_count);
+    for (Rectangle& rec : queries) rec = {rng.next_float() * 4096.f, rng.next_float() * 4096.f, 16.f, 16.f};
+
+    u64 free = 0;
+    double elapsed = best_of(5, [&]() { free = 0; }, [&]() {
+        for (const Rectangle& rec : queries) free += map.check_free(rec);
+    });
+    suite.report("query", elapsed * 1e9 / query_count, "ns/query");
+    suite.report("free", (double)free / query_count, "share", INFO_ONLY);
+}
+
+// random tower placements and removals through the editor, then the whole
+// history undone and redone. Undoing all of it has to give the start back
+void bench_editor_history(BenchSuite& suite, u64 tower_count, u64 steps) {
+    suite.begin("editor_history", TextFormat("%d towers, %d steps, flow field on", (int)tower_count, (int)steps));
+    Level level = make_large_level(31, 100, tower_count, 0);
+    level.edit_map().use_flow_field = true;
+    level.edit_map().build_flow_field();
+    std::vector<Tower> start_towers = level.towers;
+    std::vector<Rectangle> start_areas = level.map->occupied_areas;
+
+    Rng rng(37);
+    LevelEditor editor;
+    Clock::time_point start = Clock::now();
+    for (u64 i = 0; i < steps; ++i) {
+        if (rng.next() % 3 == 0 && !level.towers.empty()) {
+            editor.remove_tower((u32)(rng.next() % level.towers.size()), level);
+            continue;
+        }
+        Tower tower;
+        tower.position = {rng.next_float() * 4000.f, rng.next_float() * 4000.f};
+        if (level.map->check_free(to_rec(tower.position, tower.size))) editor.place_tower(tower, level);
+    }
+    double record = seconds_since(start);
+    u64 recorded = editor.ops.size();
+
+    start = Clock::now();
+    while (editor.undo(level)) {}
+    double undo = seconds_since(start);
+    start = Clock::now();
+    while (editor.redo(level)) {}
+    double redo = seconds_since(start);
+    while (editor.undo(level)) {}
+    level.update_flow_field(true);
+
+    auto by_position = [](Rectangle a, Rectangle b) { return a.x != b.x ? a.x < b.x : a.y < b.y; };
+    std::vector<Rectangle> areas = level.map->occupied_areas;
+    std::sort(areas.begin(), areas.end(), by_position);
+    std::sort(start_areas.begin(), start_areas.end(), by_position);
+    bool same_towers = level.towers.size() == start_towers.size() &&
+                       memcmp(level.towers.data(), start_towers.data(), start_towers.size() * sizeof(Tower)) == 0;
+    bool same_areas = areas.size() == start_areas.size() &&
+                      memcmp(areas.data(), start_areas.data(), areas.size() * sizeof(Rectangle)) == 0;
+
+    suite.report("record", record * 1e6 / recorded, "us/step");
+    suite.report("undo", undo * 1e6 / recorded, "us/step");
+    suite.report("redo", redo * 1e6 / recorded, "us/step");
+    suite.report("history", (double)editor.get_byte_size() / 1024.0, "KiB", INFO_ONLY);
+    suite.report("step", (double)sizeof(EditOp), "bytes", INFO_ONLY);
+    // what snapshotting the saved part of the level would cost per step
+    suite.report("level_copy", (double)level.get_byte_size() / 1024.0, "KiB", INFO_ONLY);
+    suite.check(same_towers && same_areas, "undoing every step restores the towers and occupied areas");
+}
+
+void bench_save_load(BenchSuite& suite, u64 waypoint_count, u64 tower_count, u64 enemy_count) {
+    suite.begin("save_load", TextFormat("%d waypoints, %d towers, %d enemies", (int)waypoint_count, (int)tower_count, (int)enemy_count));
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "tower_defense_bench";
+    std::filesystem::create_directories(dir);
+    std::string file = (dir / "save_load.blob").string();
+
+    Level level = make_large_level(13, waypoint_count, tower_count, enemy_count);
+    double save = best_of(5, []() {}, [&]() { level.save_to_file(file.c_str()); });
+    double load = best_of(5, []() {}, [&]() { std::optional<Level> loaded = Level::from_file(file.c_str()); });
+    double mb = (double)std::filesystem::file_size(file) / 1e6;
+
+    suite.report("save", save * 1000.0, "ms");
+    suite.report("load", load * 1000.0, "ms");
+    suite.report("size", mb, "MB", INFO_ONLY);
+    std::filesystem::remove(file);
+}
+
+// what an autosave costs the frame: the snapshot on the main thread against
+// save_to_file doing everything there. A tick dirties all but the map, a
+// placed tower only the towers. The autosave has to load back as the level
+static bool same_file(const std::string& a, const std::string& b) {
+    std::ifstream fa(a, std::ios::binary), fb(b, std::ios::binary);
+    std::string da((std::istreambuf_iterator<char>(fa)), std::istreambuf_iterator<char>());
+    std::string db((std::istreambuf_iterator<char>(fb)), std::istreambuf_iterator<char>());
+    return fa && fb && !da.empty() && da == db;
+}
+
+void bench_autosave(BenchSuite& suite, u64 waypoint_count, u64 tower_count, u64 enemy_count) {
+    suite.begin("autosave", TextFormat("%d waypoints, %d towers, %d enemies", (int)waypoint_count, (int)tower_count, (int)enemy_count));
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "tower_defense_bench";
+    std::filesystem::create_directories(dir);
+    std::string file = (dir / "autosave.blob").string();
+    std::string reference = (dir / "autosave_reference.blob").string();
+
+    Level level = make_large_level(13, waypoint_count, tower_count, enemy_count);
+    Rectangle bounds = level.get_bounds();
+    level.start();
+    double full = best_of(5, []() {}, [&]() { level.save_to_file(reference.c_str()); });
+
+    Autosave autosave(file);
+    autosave.save(level);
+    autosave.wait();
+    size_t file_bytes = autosave.file_bytes;
+
+    double tick_snapshot = best_of(5, [&]() { level.update(bounds, 1.f / 60.f); autosave.wait(); },
+                                   [&]() { autosave.save(level); });
+    autosave.wait();
+    size_t tick_bytes = autosave.serialized_bytes;
+
+    Rng rng(41);
+    double tower_snapshot = best_of(5, [&]() {
+        Tower tower;
+        tower.position = {rng.next_float() * 4000.f, rng.next_float() * 4000.f};
+        level.add_tower(tower);
+        autosave.wait();
+    }, [&]() { autosave.save(level); });
+    autosave.wait();
+    size_t tower_bytes = autosave.serialized_bytes;
+
+    level.save_to_file(reference.c_str());
+    std::optional<Level> loaded = Level::from_file(file.c_str());
+    bool round_trip = same_file(file, reference) && loaded && loaded->towers.size() == level.towers.size() &&
+                      loaded->enemies.size() == level.enemies.size();
+
+    suite.report("save_to_file", full * 1000.0, "ms");
+    suite.report("tick_snapshot", tick_snapshot * 1000.0, "ms");
+    suite.report("tower_snapshot", tower_snapshot * 1000.0, "ms");
+    suite.report("file", (double)file_bytes / 1024.0, "KiB", INFO_ONLY);
+    suite.report("tick_serialized", (double)tick_bytes / 1024.0, "KiB", INFO_ONLY);
+    suite.report("tower_serialized", (double)tower_bytes / 1024.0, "KiB", INFO_ONLY);
+    suite.check(round_trip, "the autosave matches save_to_file of the same level");
+    std::filesystem::remove(file);
+    std::filesystem::remove(reference);
+}
+
+static bool same_rounds(const std::vector<Round>& a, const std::vector<Round>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].length != b[i].length || a[i].events.size() != b[i].events.size()) return false;
+        if (memcmp(a[i].events.data(), b[i].events.data(), a[i].events.size() * sizeof(SpawnEvent)) != 0) return false;
+    }
+    return true;
+}
+
+// a campaign of round_count rounds with events_per_round events each, half of
+// them from repeat lines, compiled from text and then loaded from the cache
+void bench_waves(BenchSuite& suite, u64 round_count, u64 events_per_round) {
+    suite.begin("waves", TextFormat("%d rounds, %d events each", (int)round_count, (int)events_per_round));
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "tower_defense_bench";
+    std::filesystem::create_directories(dir);
+    std::string file = (dir / "waves.txt").string();
+    std::filesystem::remove(wave_cache_name(file.c_str()));
+
+    Rng rng(53);
+    std::string text = "# generated by bench_waves\n";
+    u64 event_count = 0;
+    for (u64 r = 0; r < round_count; ++r) {
+        text += TextFormat("round %d\n", 60 + (int)(rng.next() % 60));
+        for (u64 e = 0; e < events_per_round;) {
+            float start = rng.next_float() * 60.f;
+            text += TextFormat("at %.2f pos %.1f %.1f delay %.2f ", start, rng.next_float() * 4000.f, rng.next_float() * 4000.f, rng.next_float());
+            u64 repeat = std::min<u64>(1 + rng.next() % 10, events_per_round - e);
+            if (e % 2 == 1 && repeat > 1) text += TextFormat("repeat %d every %.1f grow 2 ", (int)repeat, 1.f + rng.next_float() * 4.f);
+            else repeat = 1;
+            text += TextFormat("chicken %d\n", 1 + (int)(rng.next() % 50));
+            e += repeat;
+            event_count += repeat;
+        }
+    }
+    SaveFileData(file.c_str(), text.data(), (int)text.size());
+
+    std::vector<Round> compiled;
+    bool ok = true;
+    double compile = best_of(5, []() {}, [&]() { ok &= compile_waves(text, file.c_str(), compiled); });
+    u64 compiled_events = 0;
+    bool sorted = true;
+    for (const Round& round : compiled) {
+        compiled_events += round.events.size();
+        sorted &= std::is_sorted(round.events.begin(), round.events.end(),
+                                 [](const SpawnEvent& a, const SpawnEvent& b) { return a.start < b.start; });
+    }
+
+    std::vector<Round> loaded;
+    Clock::time_point start = Clock::now();
+    ok &= load_waves(file.c_str(), loaded);
+    double first_load = seconds_since(start);
+    double cached_load = best_of(5, []() {}, [&]() { ok &= load_waves(file.c_str(), loaded); });
+    bool cache_matches = same_rounds(loaded, compiled);
+
+    // an edited source has to be compiled again, not served from the cache
+    text += "round 10\nat 0 chicken 1\n";
+    SaveFileData(file.c_str(), text.data(), (int)text.size());
+    ok &= load_waves(file.c_str(), loaded);
+    bool recompiled = loaded.size() == compiled.size() + 1;
+
+    suite.report("compile", compile * 1000.0, "ms");
+    suite.report("compile_and_cache", first_load * 1000.0, "ms");
+    suite.report("cached_load", cached_load * 1000.0, "ms");
+    suite.report("source", (double)text.size() / 1024.0, "KiB", INFO_ONLY);
+    suite.report("table", (double)std::filesystem::file_size(wave_cache_name(file.c_str())) / 1024.0, "KiB", INFO_ONLY);
+    suite.check(ok && compiled_events == event_count && sorted, "every event compiled, rounds sorted by start");
+    suite.check(cache_matches && recompiled, "the cache loads what was compiled and goes stale with its source");
+    std::filesystem::remove(file);
+    std::filesystem::remove(wave_cache_name(file.c_str()));
+}
+
+// serial loop with direct damage vs the parallel update with the damage queue
+void bench_bullets(BenchSuite& suite, u64 bullet_count, u64 enemy_count, int ticks) {
+    suite.begin("bullets", TextFormat("%llu vs %llu enemies, %u threads", (unsigned long long)bullet_count,
+                                     (unsigned long long)enemy_count, job_pool().size()));
+    Level level = make_large_level(7, 10, 0, enemy_count);
+    for (Enemy& enemy : level.enemies) enemy.hp = 1e9f;
+    Rng rng(7);
+    std::vector<Projectile> bullets(bullet_count);
+    for (Projectile& bullet : bullets) bullet = random_bullet(rng, STRAIGHT);
+    Rectangle bounds = level.get_bounds();
+    const float dt = 1.f / 60.f;
+    level.build_enemy_grid();
+
+    std::vector<DamageEvent> events;
+    level.bullets = bullets;
+    Clock::time_point start = Clock::now();
+    for (int t = 0; t < ticks; ++t) {
+        for (Projectile& bullet : level.bullets) {
+            events.clear();
+            if (bullet.update(level.enemies, level.enemy_records, level.enemy_grid, bounds, dt, events)) {
+                level.enemies[events[0].enemy].get_hit(events[0].damage);
+            }
+        }
+    }
+    double serial = seconds_since(start);
+
+    level.bullets = bullets;
+    start = Clock::now();
+    for (int t = 0; t < ticks; ++t) level.update_bullets(bounds, dt);
+    double queued = seconds_since(start);
+
+    suite.report("serial", serial * 1000.0 / ticks, "ms/tick");
+    suite.report("queued", queued * 1000.0 / ticks, "ms/tick");
+}
+
+// dense wave under lots of area damage, enemies respawn so the wave stays dense
+void bench_aoe(BenchSuite& suite, u64 tower_count, u64 enemy_count, int ticks) {
+    suite.begin("aoe", TextFormat("%llu towers vs %llu enemies", (unsigned long long)tower_count, (unsigned long long)enemy_count));
+    Rng rng(11);
+    Level level("bench", {0.f, 0.f, 2048.f, 2048.f});
+    Map& map = level.edit_map();
+    map.waypoints = {{0.f, 0.f}, {2048.f, 2048.f}};
+    for (u64 i = 0; i < tower_count; ++i) {
+        Tower tower;
+        tower.type = i % 2 ? TOWER_AURA : TOWER_SPLASH;
+        // hundreds of impacts per tick
+        tower.modifiers.reload_time = 0.1f;
+        tower.position = {rng.next_float() * 2048.f, rng.next_float() * 2048.f};
+        level.add_tower(tower);
+    }
+    Rectangle bounds = level.get_bounds();
+    const float dt = 1.f / 60.f;
+
+    auto refill = [&]() {
+        for (u64 i = level.enemies.size(); i < enemy_count; ++i) {
+            Enemy enemy;
+            enemy.hp = 200.f;
+            enemy.set_position({rng.next_float() * 2048.f, rng.next_float() * 2048.f});
+            enemy.next_waypoint = 1;
+            level.add_enemy(enemy);
+        }
+    };
+
+    u64 kills = 0;
+    u64 impacts = 0;
+    double elapsed = 0.0;
+    for (int t = 0; t < ticks; ++t) {
+        refill();
+        u64 killed = level.stats.killed;
+        u64 hits = level.stats.hits;
+        Clock::time_point start = Clock::now();
+        level.update_towers(dt);
+        level.update_bullets(bounds, dt);
+        level.update_enemies(dt);
+        elapsed += seconds_since(start);
+        kills += level.stats.killed - killed;
+        impacts += level.stats.hits - hits;
+    }
+    suite.report("tick", elapsed * 1000.0 / ticks, "ms");
+    suite.report("impacts", (double)impacts / ticks, "per tick", INFO_ONLY);
+    suite.report("kills", (double)kills / ticks, "per tick", INFO_ONLY);
+}
+
+// full level ticks on a crowded map, bytes per entity are what the loops stream through
+void bench_enemy_tick(BenchSuite& suite, u64 enemy_count, u64 tower_count, int ticks) {
+    suite.begin("enemy_tick", TextFormat("%llu enemies, %llu towers", (unsigned long long)enemy_count, (unsigned long long)tower_count));
+    Level level = make_large_level(3, 50, tower_count, enemy_count);
+    // spread over the whole path
+    Rng rng(3);
+    for (Enemy& enemy : level.enemies) enemy.next_waypoint = rng.range(0, 49);
+    level.rebuild_path_progress();
+    level.start();
+    Rectangle bounds = level.get_bounds();
+    const float dt = 1.f / 60.f;
+    Clock::time_point start = Clock::now();
+    for (int t = 0; t < ticks; ++t) level.update(bounds, dt);
+    double elapsed = seconds_since(start);
+    suite.report("enemy_bytes", (double)sizeof(Enemy), "bytes", INFO_ONLY);
+    suite.report("record_bytes", (double)sizeof(EnemyRecord), "bytes", INFO_ONLY);
+    suite.report("tower_bytes", (double)sizeof(Tower), "bytes", INFO_ONLY);
+    suite.report("projectile_bytes", (double)sizeof(Projectile), "bytes", INFO_ONLY);
+    suite.report("tick", elapsed * 1000.0 / ticks, "ms");
+    suite.report("enemies", (double)enemy_count * ticks / elapsed / 1e6, "M/s", HIGHER_BETTER);
+
+    // near exit count off the path buckets vs scanning every enemy
+    const int queries = 1000;
+    const std::vector<Vector2>& waypoints = level.map->waypoints;
+    float distance = level.path.get_path_length() * 0.1f;
+    u64 found = 0;
+    start = Clock::now();
+    for (int q = 0; q < queries; ++q) found += level.path.count_near_exit(distance);
+    double bucketed = seconds_since(start);
+    u64 scanned_found = 0;
+    start = Clock::now();
+    for (int q = 0; q < queries / 100; ++q) {
+        float threshold = level.path.get_path_length() - distance;
+        for (const Enemy& enemy : level.enemies) {
+            if (level.path.get_progress(enemy.next_waypoint, enemy.get_center(), waypoints) >= threshold) scanned_found++;
+        }
+    }
+    double scan = seconds_since(start) * 100.0;
+    suite.report("near_exit", bucketed * 1e6 / queries, "us");
+    suite.report("near_exit_scan", scan * 1e6 / queries, "us");
+    suite.report("near_exit_found", (double)(found / queries), "enemies", INFO_ONLY);
+    suite.report("near_exit_scan_found", (double)(scanned_found / (queries / 100)), "enemies", INFO_ONLY);
+}
+
+struct ScenarioParams {
+    u64 enemies = 0;
+    u64 towers = 0;
+    u64 bullets = 0;
+
+    std::string get_name() const {
+        return "scenario/e" + std::to_string(enemies) + "_t" + std::to_string(towers) + "_b" + std::to_string(bullets);
+    }
+};
+
+static void top_up(Level& level, Rng& rng, ScenarioParams params, int waypoint_count) {
+    for (u64 i = level.enemies.size(); i < params.enemies; ++i) {
+        Enemy enemy;
+        enemy.set_position({rng.next_float() * 4096.f, rng.next_float() * 4096.f});
+        enemy.next_waypoint = rng.range(0, waypoint_count - 1);
+        level.add_enemy(enemy);
+    }
+    for (u64 i = level.bullets.size(); i < params.bullets; ++i) {
+        level.bullets.push_back(random_bullet(rng, STRAIGHT));
+    }
+}
+
+// whole level ticks with the entity counts held steady, whatever dies or
+// leaves is topped up between ticks, outside the timing
+void bench_scenario(BenchSuite& suite, ScenarioParams params, int ticks) {
+    suite.begin(params.get_name(), TextFormat("%d ticks", ticks));
+    const int waypoint_count = 50;
+    Level level = make_large_level(17, waypoint_count, params.towers, 0);
+    level.rounds.clear();
+    Rng rng(17);
+    Rectangle bounds = level.get_bounds();
+    const float dt = 1.f / 60.f;
+    level.start();
+
+    u64 live_enemies = 0;
+    u64 live_bullets = 0;
+    u64 allocations = 0;
+    double elapsed = 0.0;
+    for (int t = 0; t < ticks; ++t) {
+        top_up(level, rng, params, waypoint_count);
+        live_enemies += level.enemies.size();
+        live_bullets += level.bullets.size();
+        u64 allocations_before = alloc_tracker().total_allocations.load();
+        Clock::time_point start = Clock::now();
+        level.update(bounds, dt);
+        elapsed += seconds_since(start);
+        allocations += alloc_tracker().total_allocations.load() - allocations_before;
+    }
+    suite.report("tick", elapsed * 1000.0 / ticks, "ms");
+    suite.report("allocations", (double)allocations / ticks, "per tick");
+    suite.report("enemies", (double)live_enemies / ticks, "live", INFO_ONLY);
+    suite.report("bullets", (double)live_bullets / ticks, "live", INFO_ONLY);
+    suite.report("killed", (double)level.stats.killed / ticks, "per tick", INFO_ONLY);
+}
+
+// once every array has grown to the wave, a tick plus a frame's worth of hud
+// text must not touch the general heap. Every tower type so all the damage
+// paths run, the pool gets more than one chunk of bullets.
+// busy_pool keeps the pool queue full of 5 ms jobs like ground tiles and
+// autosaves, parallel_for helpers then start late or never
+void bench_steady_state(BenchSuite& suite, int warmup_ticks, int ticks, bool busy_pool) {
+    suite.begin(busy_pool ? "steady_state_busy_pool" : "steady_state",
+                TextFormat("%d ticks after %d warmup%s", ticks, warmup_ticks, busy_pool ? ", long jobs queued" : ""));
+    const int waypoint_count = 50;
+    ScenarioParams params = {10000, 200, 4000};
+    Level level = make_large_level(19, waypoint_count, params.towers, 0);
+    for (u32 i = 0; i < level.towers.size(); ++i) level.towers[i].type = (Tower_Type)(i % TOWER_TYPE_MAX);
+    level.rounds.clear();
+    Rng rng(19);
+    Rectangle bounds = level.get_bounds();
+    const float dt = 1.f / 60.f;
+    level.start();
+
+    auto frame = [&]() {
+        level.update(bounds, dt);
+        const char* hud = frame_format("enemies.size = %d, bullets.size = %d", (int)level.enemies.size(), (int)level.bullets.size());
+        std::pmr::string text = level.to_string("", &frame_arena());
+        assert(hud[0] != 0 && !text.empty());
+        reset_frame_arena();
+    };
+
+    std::atomic<u32> queued = 0;
+    const u32 max_queued = job_pool().size() * 2;
+    // outside the counted part, the task ring may grow
+    auto queue_jobs = [&]() {
+        if (!busy_pool) return;
+        while (queued.load() < max_queued) {
+            queued.fetch_add(1);
+            job_pool().submit([&queued] {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                queued.fetch_sub(1);
+            });
+        }
+    };
+
+    for (int t = 0; t < warmup_ticks; ++t) {
+        top_up(level, rng, params, waypoint_count);
+        queue_jobs();
+        frame();
+    }
+    u64 allocations = 0;
+    for (int t = 0; t < ticks; ++t) {
+        top_up(level, rng, params, waypoint_count);
+        queue_jobs();
+        u64 allocations_before = alloc_tracker().total_allocations.load();
+        frame();
+        allocations += alloc_tracker().total_allocations.load() - allocations_before;
+    }
+    while (queued.load() != 0) std::this_thread::yield();
+    suite.report("allocations", (double)allocations, "total");
+    suite.report("arena_peak", (double)frame_arena().peak, "bytes", INFO_ONLY);
+    suite.check(allocations == 0, "steady state ticks allocated from the heap");
+}
+
+// cost on the calling thread, the writer formats into nothing meanwhile
+void bench_logger(BenchSuite& suite, int messages) {
+    suite.begin("logger", TextFormat("%d messages", messages));
+    Logger& log = logger();
+    log.set_output(nullptr);
+    log.set_level(LOG_COMBAT, FULL);
+    // less than the ring holds, nothing gets dropped
+    double enabled = best_of(5, [&]() { log.flush(); }, [&]() {
+        for (int i = 0; i < messages; ++i) log_full(LOG_COMBAT, "enemy {} leaked at t = {}", i, 1.5f);
+    });
+    log.set_level(LOG_COMBAT, LOW);
+    double filtered = best_of(5, []() {}, [&]() {
+        for (int i = 0; i < messages; ++i) log_full(LOG_COMBAT, "enemy {} leaked at t = {}", i, 1.5f);
+    });
+    log.flush();
+    suite.report("push", enabled * 1e9 / messages, "ns/message");
+    suite.report("filtered", filtered * 1e9 / messages, "ns/message");
+    suite.report("dropped", (double)log.dropped.load(), "messages", INFO_ONLY);
+    log.set_level(NO_LOG);
+    log.set_output(stdout);
+}
+
+struct Benchmark {
+    std::string name;
+    std::function<void(BenchSuite&)> run;
+};
+
+struct BenchOptions {
+    const char* filter = nullptr;
+    const char* out_file = nullptr;
+    const char* baseline_file = nullptr;
+    double threshold = 0.1;
+    int scenario_ticks = 120;
+    std::vector<ScenarioParams> scenarios;
+    bool list = false;
+};
+
+void print_usage() {
+    printf("usage: tower_defense_bench [options]\n");
+    printf("  -f <filter>      only run benchmarks whose name contains this\n");
+    printf("  -l               list the benchmarks and exit\n");
+    printf("  -o <file>        write the results as json\n");
+    printf("  -c <file>        compare against a json written by -o, exits 1 on a regression\n");
+    printf("  -t <percent>     how much worse a result may get before -c flags it (10)\n");
+    printf("  -s <e>x<t>x<b>   scenario with e enemies, t towers and b bullets, repeatable,\n");
+    printf("                   replaces the default scenarios\n");
+    printf("  -n <ticks>       ticks per scenario (120)\n");
+}
+
+bool parse_scenario(const char* value, ScenarioParams& params) {
+    unsigned long long enemies, towers, bullets;
+    if (sscanf(value, "%llux%llux%llu", &enemies, &towers, &bullets) != 3) return false;
+    params = {enemies, towers, bullets};
+    return true;
+}
+
+bool parse_options(int argc, char** argv, BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-l") {
+            options.list = true;
+            continue;
+        }
+        if (i + 1 >= argc) return false;
+        const char* value = argv[++i];
+        if (arg == "-f") options.filter = value;
+        else if (arg == "-o") options.out_file = value;
+        else if (arg == "-c") options.baseline_file = value;
+        else if (arg == "-t") options.threshold = strtod(value, nullptr) / 100.0;
+        else if (arg == "-n") options.scenario_ticks = (int)strtol(value, nullptr, 10);
+        else if (arg == "-s") {
+            ScenarioParams params;
+            if (!parse_scenario(value, params)) return false;
+            options.scenarios.push_back(params);
+        }
+        else return false;
+    }
+    return options.scenario_ticks > 0 && options.threshold >= 0.0;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage();
+        return 1;
+    }
+    // the levels' own messages would drown the results
+    logger().set_level(NO_LOG);
+    if (options.scenarios.empty()) {
+        options.scenarios = {{1000, 50, 500}, {10000, 200, 2000}, {50000, 500, 10000}};
+    }
+
+    std::vector<Benchmark> benchmarks = {
+        {"noise", [](BenchSuite& s) { bench_noise(s, 2048, 2048, 5); }},
+        {"ground_tiles", [](BenchSuite& s) { bench_ground_tiles(s, 20); }},
+        {"campaign_load", [](BenchSuite& s) { bench_campaign_load(s, 50); }},
+        {"spawn_round", [](BenchSuite& s) { bench_spawn_round(s, 1000, 100); }},
+        {"burst_spawn", [](BenchSuite& s) { bench_burst_spawn(s, 10000, 20); }},
+        {"flow_field", [](BenchSuite& s) { bench_flow_field(s, 1024, 100); }},
+        {"tower_update", [](BenchSuite& s) { bench_tower_update(s, 2000, 20000); }},
+        {"projectile_update", [](BenchSuite& s) { bench_projectile_update(s, 20000, 10000); }},
+        {"enemy_update", [](BenchSuite& s) { bench_enemy_update(s, 100000); }},
+        {"remove_inactive", [](BenchSuite& s) { bench_remove_inactive(s, 100000); }},
+        {"check_free", [](BenchSuite& s) { bench_check_free(s, 1000, 10000); }},
+        {"editor_history", [](BenchSuite& s) { bench_editor_history(s, 2000, 5000); }},
+        {"save_load", [](BenchSuite& s) { bench_save_load(s, 1000, 1000, 20000); }},
+        {"autosave", [](BenchSuite& s) { bench_autosave(s, 1000, 1000, 20000); }},
+        {"waves", [](BenchSuite& s) { bench_waves(s, 100, 100); }},
+        {"bullets", [](BenchSuite& s) { bench_bullets(s, 5000, 1000, 10); }},
+        {"aoe", [](BenchSuite& s) { bench_aoe(s, 500, 20000, 120); }},
+        {"enemy_tick", [](BenchSuite& s) { bench_enemy_tick(s, 100000, 200, 120); }},
+        {"steady_state", [](BenchSuite& s) { bench_steady_state(s, 120, 240, false); }},
+        {"steady_state_busy_pool", [](BenchSuite& s) { bench_steady_state(s, 120, 240, true); }},
+        {"logger", [](BenchSuite& s) { bench_logger(s, 2000); }},
+    };
+    for (ScenarioParams params : options.scenarios) {
+        int ticks = options.scenario_ticks;
+        benchmarks.push_back({params.get_name(), [params, ticks](BenchSuite& s) { bench_scenario(s, params, ticks); }});
+    }
+
+    if (options.list) {
+        for (const Benchmark& benchmark : benchmarks) printf("%s\n", benchmark.name.c_str());
+        return 0;
+    }
+
+    // read up front so a bad path fails before minutes of benchmarking
+    std::vector<BenchResult> baseline;
+    if (options.baseline_file && !read_baseline(options.baseline_file, baseline)) {
+        std::cerr << "could not read baseline " << options.baseline_file << "\n";
+        return 1;
+    }
+
+    BenchSuite suite;
+    for (const Benchmark& benchmark : benchmarks) {
+        if (options.filter && benchmark.name.find(options.filter) == std::string::npos) continue;
+        benchmark.run(suite);
+    }
+
+    if (options.out_file && !suite.write_json(options.out_file)) {
+        std::cerr << "could not write " << options.out_file << "\n";
+        return 1;
+    }
+    for (const std::string& failure : suite.failures) printf("FAILED %s\n", failure.c_str());
+    if (options.baseline_file && compare_results(suite.results, baseline, options.threshold) > 0) return 1;
+    return suite.failures.empty() ? 0 : 1;
+}
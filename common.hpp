@@ -7,3 +7,27 @@ typedef uint32_t u32;
 enum MenuIndex {
     MENU_MAIN, MENU_MAX, 
 };
+
+// small deterministic rng (xorshift64*), GetRandomValue shares one global state
+struct Rng {
+    u64 state;
+
+    Rng(u64 seed = 0) : state(seed * 0x9E3779B97F4A7C15ull + 1) {}
+
+    u32 next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return (u32)((state * 0x2545F4914F6CDD1Dull) >> 32);
+    }
+
+    // [0, 1)
+    float next_float() {
+        return (next() >> 8) * (1.f / 16777216.f);
+    }
+
+    // [min, max]
+    int range(int min, int max) {
+        return min + (int)(next() % (u32)(max - min + 1));
+    }
+};
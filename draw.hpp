@@ -17,6 +17,30 @@ float center_text(Font font, const char* text, Rectangle boundary, Vector2* posi
     return font_size;
 }
 
+// center_text through the item's cached layout, measures only when the text or
+// the rectangle changed since the last time
+const TextLayout& fit_text(Font font, const char* text, Rectangle boundary, TextLayout& layout) {
+    Rectangle& last = layout.fitted_into;
+    if (!layout.valid || last.x != boundary.x || last.y != boundary.y || last.width != boundary.width || last.height != boundary.height) {
+        layout.font_size = center_text(font, text, boundary, &layout.position);
+        layout.fitted_into = boundary;
+        layout.valid = true;
+    }
+    return layout;
+}
+
+// circle against the view, for culling
+bool in_view(Rectangle view, Vector2 center, float radius) {
+    return center.x + radius >= view.x && center.x - radius <= view.x + view.width &&
+           center.y + radius >= view.y && center.y - radius <= view.y + view.height;
+}
+
+// world rectangle the camera shows on a width x height screen
+Rectangle get_camera_view(Camera2D camera, float width, float height) {
+    Vector2 corner = GetScreenToWorld2D({0.f, 0.f}, camera);
+    return {corner.x, corner.y, width / camera.zoom, height / camera.zoom};
+}
+
 Rectangle squish_rec(Rectangle rec, float dist) {
     rec.x += dist;
     rec.y += dist;
@@ -29,40 +53,40 @@ Rectangle squish_rec(Rectangle rec, float dist) {
 struct Renderer {
     Rectangle bounds;
     bool draw_debug = true;
-
-    void draw_map(const Map& map); 
-    void draw_level(const Level& level);
+    // the gui as of gui_cache_version, transparent where there is no menu
+    RenderTexture2D gui_cache = {};
+    u64 gui_cache_version = 0;
+
+    // the visible ground tiles, lod picked from zoom
+    void draw_ground(const Map& map, Rectangle view, float zoom);
+    void draw_map(const Map& map, Rectangle view, float zoom);
+    void draw_level(const Level& level, Camera2D camera);
+    // map and entities in world coordinates, whatever is outside view skipped
+    void draw_level_world(const Level& level, Rectangle view, float zoom);
+    void draw_level_hud(const Level& level);
+    // every level scaled into a grid cell
+    void draw_level_grid(const Game& game);
     void draw_enemy(const Enemy& enemy, const Map& map);
     void draw_tower(const Tower& tower, const std::vector<EnemyRecord>& enemy_records);
     void draw_bullet(const Projectile& bullet);
     void draw_game(const Game& game);
+    // last frame's allocations per phase and the Level array peaks
+    void draw_alloc_panel(const AllocTracker& tracker, Vector2 position);
 
-    void draw_gui(const Game& game, const Gui& gui) {
-        // not started game yet
-        if (game.active_level == -1) {
-            // TODO:: enum ins commons
-            draw_menu(gui.menues[MENU_MAIN]); 
-        }
-        else if (game.edit_mode) {
-            // draw edit menu
-        }
-        if (game.paused){
-            // draw pause menu
-        }
-
-    }
+    // the visible menus, redrawn into gui_cache only after gui.version moved
+    void draw_gui(const Gui& gui);
+    // gpu resources, before the window closes
+    void unload();
 
     void draw_menu(const Menu& menu) {
         for (const MenuItem* item : menu.items) {
-            const Button* b = dynamic_cast<const Button*>(item);
-            const TextBox* t = dynamic_cast<const TextBox*>(item);
-
-            if (b) {
-                draw_button(*b);
-            }
-
-            if (t) {
-                draw_textbox(*t);
+            switch (item->type) {
+            case ITEM_BUTTON:
+                draw_button(*static_cast<const Button*>(item));
+                break;
+            case ITEM_TEXTBOX:
+                draw_textbox(*static_cast<const TextBox*>(item));
+                break;
             }
         }
     }
@@ -82,9 +106,10 @@ struct Renderer {
         }
         if (button.text) {
             Rectangle rec = squish_rec(button.boundary, button.down ? 13.f : 10.f);
-            Vector2 position;
-            float font_size = center_text(GetFontDefault(), button.text, rec, &position);
-            
+            const TextLayout& layout = fit_text(GetFontDefault(), button.text, rec, button.layout);
+            Vector2 position = layout.position;
+            float font_size = layout.font_size;
+
             //DrawText(button.text, button.boundary.x, button.boundary.y, (font_size.y + font_size.x) / 2.f, BLACK);
             Color text_color = button.text_color;
             if (button.hovered) text_color = ColorBrightness(text_color, -0.5f);
@@ -99,9 +124,8 @@ struct Renderer {
         DrawRectangleRec(textbox.boundary, WHITE);
         DrawRectangleLinesEx(textbox.boundary, 1.f, BLACK);
         Font font = GetFontDefault();
-        Vector2 position;
-        float font_size = center_text(font, textbox.text.c_str(), squish_rec(textbox.boundary, 5.f), &position);
-        DrawTextEx(font, textbox.text.c_str(), position, font_size, 1.f, BLACK);
+        const TextLayout& layout = fit_text(font, textbox.text.c_str(), squish_rec(textbox.boundary, 5.f), textbox.layout);
+        DrawTextEx(font, textbox.text.c_str(), layout.position, layout.font_size, 1.f, BLACK);
     }
 
 };
@@ -137,6 +161,8 @@ void Window::open() {
 }
 
 void Window::close() {
+    renderer.unload();
+    ground_tiles().clear();
     CloseWindow();
 }
 
@@ -147,7 +173,10 @@ void Window::resize_if_needed() {
 }
 void Window::draw(const Game& game, const Gui& gui) {
     renderer.draw_game(game);
-    renderer.draw_gui(game, gui);
+    renderer.draw_gui(gui);
+#if ALLOC_TRACKING
+    if (game.show_alloc_panel) renderer.draw_alloc_panel(alloc_tracker(), {10.f, 110.f});
+#endif
 }
 
 void Window::set_fps(u64 fps) {
@@ -159,19 +188,103 @@ void Window::set_fps(u64 fps) {
 Rectangle Window::get_game_boundary() const {
     return {0.f, 0.f, (float)width, (float)height};
 }
-void Renderer::draw_map(const Map& map) {
-    // draw ground
-    Rectangle source = {.x = 0, .y = 0, .width = (float)map.ground_tex.width, .height = (float)map.ground_tex.height};
-    Rectangle dest = {.x = 0, .y = 0, .width = bounds.width, .height = bounds.height};
-    DrawTexturePro(map.ground_tex, source, dest, {0.f, 0.f}, 0.f, WHITE);
+void Renderer::draw_gui(const Gui& gui) {
+    // the cache would be all blank, not worth a fullscreen blend
+    if (!gui.any_visible()) return;
+    int width = GetScreenWidth();
+    int height = GetScreenHeight();
+    if (gui_cache.id == 0 || gui_cache.texture.width != width || gui_cache.texture.height != height) {
+        if (gui_cache.id != 0) UnloadRenderTexture(gui_cache);
+        gui_cache = LoadRenderTexture(width, height);
+        gui_cache_version = 0;
+    }
+    if (gui_cache_version != gui.version) {
+        BeginTextureMode(gui_cache);
+        ClearBackground(BLANK);
+        for (const Menu& menu : gui.menues) {
+            if (menu.visible) draw_menu(menu);
+        }
+        EndTextureMode();
+        gui_cache_version = gui.version;
+    }
+    // render textures are stored upside down
+    Rectangle source = {0.f, 0.f, (float)width, -(float)height};
+    DrawTextureRec(gui_cache.texture, source, {0.f, 0.f}, WHITE);
+}
+
+void Renderer::unload() {
+    if (gui_cache.id != 0) UnloadRenderTexture(gui_cache);
+    gui_cache = {};
+}
+
+void Renderer::draw_ground(const Map& map, Rectangle view, float zoom) {
+    GroundTiles& tiles = ground_tiles();
+    int lod = GroundTiles::lod_for_zoom(zoom);
+    float span = GroundTiles::get_span(lod);
+    float x_begin = std::max(view.x, 0.f);
+    float y_begin = std::max(view.y, 0.f);
+    float x_end = std::min(view.x + view.width, (float)map.width);
+    float y_end = std::min(view.y + view.height, (float)map.height);
+    if (x_begin >= x_end || y_begin >= y_end) return;
+
+    // halfway between the noise colors, for tiles not generated yet
+    NoiseParams params;
+    Color fill = {(unsigned char)((params.low.r + params.high.r) / 2), (unsigned char)((params.low.g + params.high.g) / 2),
+                  (unsigned char)((params.low.b + params.high.b) / 2), 255};
+    int tx_begin = (int)(x_begin / span);
+    int ty_begin = (int)(y_begin / span);
+    int tx_end = (int)ceilf(x_end / span);
+    int ty_end = (int)ceilf(y_end / span);
+    for (int ty = ty_begin; ty < ty_end; ++ty) {
+        for (int tx = tx_begin; tx < tx_end; ++tx) {
+            // the last row and column stop at the map edge
+            Rectangle dest = {tx * span, ty * span, span, span};
+            dest.width = std::min(span, (float)map.width - dest.x);
+            dest.height = std::min(span, (float)map.height - dest.y);
+
+            const Texture* texture = tiles.find(map.ground_seed, lod, tx, ty);
+            int texture_lod = lod;
+            if (!texture) {
+                tiles.request(map.ground_seed, lod, tx, ty);
+                // blurry beats blank while it's generated
+                for (int coarser = lod + 1; coarser <= GroundTiles::MAX_LOD && !texture; ++coarser) {
+                    int shift = coarser - lod;
+                    texture = tiles.find(map.ground_seed, coarser, tx >> shift, ty >> shift);
+                    texture_lod = coarser;
+                }
+            }
+            if (!texture) {
+                DrawRectangleRec(dest, fill);
+                continue;
+            }
+            float texture_span = GroundTiles::get_span(texture_lod);
+            float texel = (float)(1 << texture_lod);
+            Rectangle source = {
+                .x = (dest.x - floorf(dest.x / texture_span) * texture_span) / texel,
+                .y = (dest.y - floorf(dest.y / texture_span) * texture_span) / texel,
+                .width = dest.width / texel,
+                .height = dest.height / texel,
+            };
+            DrawTexturePro(*texture, source, dest, {0.f, 0.f}, 0.f, WHITE);
+        }
+    }
+}
+
+void Renderer::draw_map(const Map& map, Rectangle view, float zoom) {
+    draw_ground(map, view, zoom);
 
     // draw waypoints
     for (int i = 0; i < map.waypoints.size(); ++i) {
         Vector2 current = map.waypoints[i]; 
-        DrawCircleV(current, 1, RED);
-        if (i == map.waypoints.size() - 1) continue;
+        if (i == map.waypoints.size() - 1) {
+            if (in_view(view, current, 1.f)) DrawCircleV(current, 1, RED);
+            continue;
+        }
 
         Vector2 next = map.waypoints[i + 1]; 
+        Vector2 middle = Vector2Scale(Vector2Add(current, next), 0.5f);
+        if (!in_view(view, middle, Vector2Distance(current, next) / 2.f + map.road_width)) continue;
+        DrawCircleV(current, 1, RED);
         //DrawLineV(current, next, BLUE);
 
         Vector2 dir = Vector2Subtract(next, current);
@@ -189,39 +302,60 @@ void Renderer::draw_map(const Map& map) {
         DrawLineV(road_current, road_next, BROWN);
     }
 }
-void Renderer::draw_level(const Level& level) {
+void Renderer::draw_level(const Level& level, Camera2D camera) {
+    BeginMode2D(camera);
+    draw_level_world(level, get_camera_view(camera, (float)GetScreenWidth(), (float)GetScreenHeight()), camera.zoom);
+    EndMode2D();
+    draw_level_hud(level);
+}
+
+void Renderer::draw_level_world(const Level& level, Rectangle view, float zoom) {
     // draw map
-    draw_map(level.map);
+    draw_map(*level.map, view, zoom);
     // draw enemies
     for (const Enemy& enemy : level.enemies) {
-        draw_enemy(enemy, level.map);
+        if (!CheckCollisionRecs(enemy.boundary, view)) continue;
+        draw_enemy(enemy, *level.map);
     }
-    // draw buildings
+    // draw buildings, the range circle reaches furthest
     for (const Tower& tower: level.towers) {
+        float reach = std::max(tower.get_range(), Vector2Length(tower.size));
+        if (!in_view(view, tower.get_center(), reach)) continue;
         draw_tower(tower, level.enemy_records);
     }
     
     for (const Projectile& bullet: level.bullets) {
+        if (!in_view(view, bullet.position, bullet.get_archetype().radius)) continue;
         draw_bullet(bullet);
     }
 
-    for (const EnemySpawner& spawner: level.spawners) {
-        //if (spawner.active == false) continue;
-        Color color = WHITE;
-        if (spawner.active == false) color = GRAY;
-        DrawCircleV(spawner.position, 5.f, color);
+    for (const EnemySpawner& spawner: level.scheduler.spawners) {
+        if (!in_view(view, spawner.position, 5.f)) continue;
+        DrawCircleV(spawner.position, 5.f, WHITE);
+    }
+}
+
+void Renderer::draw_level_hud(const Level& level) {
+    DrawText(frame_format("enemies.size = %d", (int)level.enemies.size()), bounds.width / 2.f, 0, 20, WHITE);
+    DrawText(frame_format("enemy_records.size = %d", (int)level.enemy_records.size()), bounds.width / 2.f, 100, 20, WHITE);
+    DrawText(frame_format("bullets.size = %d", (int)level.bullets.size()), bounds.width / 1.3f, 0, 20, WHITE);
+    DrawText(frame_format("hit rate = %.2f, live bullets = %.1f", level.stats.hit_rate(), level.stats.average_bullets()), bounds.width / 1.3f, 30, 20, WHITE);
+    DrawText(frame_format("spawners.size = %d", (int)level.scheduler.size()), bounds.width / 1.3f, 200, 20, WHITE);
+    DrawText(frame_format("Time: %f", level.time), 10, 10, 20, WHITE);
+    const GroundTiles& tiles = ground_tiles();
+    DrawText(frame_format("ground tiles = %d (%d KiB), %d pending", (int)tiles.size(), (int)(tiles.get_texture_bytes() / 1024),
+                        (int)tiles.get_pending()), 10, 40, 20, WHITE);
+    // threat meter, both O(1) / O(log n) off the path buckets
+    if (!level.path.empty()) {
+        DrawText(frame_format("lead enemy %d px from exit, %d within 200 px", (int)level.path.get_leader_distance_to_exit(),
+                            (int)level.path.count_near_exit(200.f)), 10, 70, 20, WHITE);
     }
-    DrawText(TextFormat("enemies.size = %d", level.enemies.size()), bounds.width / 2.f, 0, 20, WHITE);
-    DrawText(TextFormat("enemy_records.size = %d", level.enemy_records.size()), bounds.width / 2.f, 100, 20, WHITE);
-    DrawText(TextFormat("bullets.size = %d", level.bullets.size()), bounds.width / 1.3f, 0, 20, WHITE);
-    DrawText(TextFormat("spawners.size = %d", level.spawners.size()), bounds.width / 1.3f, 200, 20, WHITE);
-    DrawText(TextFormat("Time: %f", level.time), 10, 10, 20, WHITE);
 
 }
 
 void Renderer::draw_bullet(const Projectile& bullet) {
     if (bullet.active == false) return;
-    DrawCircleV(bullet.position, bullet.radius, YELLOW);
+    DrawCircleV(bullet.position, bullet.get_archetype().radius, bullet.type == SPLASH ? ORANGE : YELLOW);
 }
 
 void Renderer::draw_enemy(const Enemy& enemy, const Map& map) {
@@ -250,23 +384,59 @@ void Renderer::draw_tower(const Tower& tower, const std::vector<EnemyRecord>& en
         Rectangle tower_rec = {tower.position.x, tower.position.y, tower.size.x, tower.size.y};
         DrawRectangleRec(tower_rec, color);
         DrawLineV(tower.get_center(), Vector2Add(tower.get_center(), Vector2Scale(tower.direction, 2.f)), GREEN);
-        DrawCircleLinesV(tower.get_center(), tower.range, RED);
+        DrawCircleLinesV(tower.get_center(), tower.get_range(), tower.type == TOWER_AURA ? SKYBLUE : RED);
         if (tower.target_lock) {
             DrawLineV(tower.get_center(), enemy_records[tower.target_id].center, RED);
         }
     }
 }
 
+void Renderer::draw_level_grid(const Game& game) {
+    int count = (int)game.levels.size();
+    if (count == 0) return;
+    int columns = (int)ceilf(sqrtf((float)count));
+    int rows = (count + columns - 1) / columns;
+    float cell_width = bounds.width / columns;
+    float cell_height = bounds.height / rows;
+
+    for (int i = 0; i < count; ++i) {
+        const Level& level = game.levels[i];
+        Rectangle cell = {(i % columns) * cell_width, (i / columns) * cell_height, cell_width, cell_height};
+        Rectangle level_bounds = level.get_bounds();
+        float zoom = 1.f;
+        if (level_bounds.width > 0.f && level_bounds.height > 0.f) {
+            zoom = fminf(cell.width / level_bounds.width, cell.height / level_bounds.height);
+        }
+        Camera2D camera = {.offset = {cell.x, cell.y}, .target = {0.f, 0.f}, .rotation = 0.f, .zoom = zoom};
+
+        BeginScissorMode(cell.x, cell.y, cell.width, cell.height);
+        BeginMode2D(camera);
+        draw_level_world(level, level_bounds, zoom);
+        EndMode2D();
+        EndScissorMode();
+
+        DrawRectangleLinesEx(cell, 1.f, BLACK);
+        DrawText(frame_format("%s  t = %.1f  enemies = %d", level.name.c_str(), level.time, (int)level.enemies.size()),
+                 cell.x + 4, cell.y + 4, 10, WHITE);
+    }
+    DrawText(frame_format("%d levels, %.0f ticks/s", count, game.ticks_per_second), 10, bounds.height - 30, 20, WHITE);
+}
+
 void Renderer::draw_game(const Game& game) {
+    ground_tiles().begin_frame();
+    if (game.simulate_all) {
+        draw_level_grid(game);
+        return;
+    }
     if (game.edit_mode) {
-        draw_level(game.edit_level);
+        draw_level(game.edit_level, game.camera);
         return;
     }
 
     assert(game.active_level < (int)game.levels.size());
 
     if (game.active_level >= 0) {
-        draw_level(game.levels[game.active_level]);
+        draw_level(game.levels[game.active_level], game.camera);
     } 
     // draw menu
     else {
@@ -274,3 +444,33 @@ void Renderer::draw_game(const Game& game) {
     }
 }
 
+void Renderer::draw_alloc_panel(const AllocTracker& tracker, Vector2 position) {
+    if (tracker.empty()) return;
+    const int font_size = 10;
+    const int line = 12;
+    Rectangle panel = {position.x, position.y, 300.f, (float)(line * ((int)ALLOC_PHASE_MAX + (int)ALLOC_CONTAINER_MAX + 4))};
+    DrawRectangleRec(panel, Fade(BLACK, 0.7f));
+
+    const AllocFrame& frame = tracker.get_last_frame();
+    int x = (int)position.x + 4;
+    int y = (int)position.y + 2;
+    DrawText(frame_format("frame %llu, %llu allocations total", (unsigned long long)frame.frame,
+                        (unsigned long long)tracker.total_allocations.load()), x, y, font_size, WHITE);
+    y += line;
+    DrawText("phase          allocs   frees     KiB   peak", x, y, font_size, GRAY);
+    for (int p = 0; p < ALLOC_PHASE_MAX; ++p) {
+        y += line;
+        const AllocCounters& counters = frame.phases[p];
+        Color color = counters.allocations > 0 ? YELLOW : WHITE;
+        DrawText(frame_format("%-12s %8llu %7llu %7.1f %6llu", ALLOC_PHASE_NAMES[p], (unsigned long long)counters.allocations,
+                            (unsigned long long)counters.frees, counters.bytes / 1024.0,
+                            (unsigned long long)tracker.get_peak_allocations((Alloc_Phase)p)), x, y, font_size, color);
+    }
+    y += line * 2;
+    DrawText("array           KiB    peak KiB", x, y, font_size, GRAY);
+    for (int c = 0; c < ALLOC_CONTAINER_MAX; ++c) {
+        y += line;
+        DrawText(frame_format("%-14s %7.1f %9.1f", ALLOC_CONTAINER_NAMES[c], tracker.container_bytes[c] / 1024.0,
+                            tracker.container_peak[c] / 1024.0), x, y, font_size, WHITE);
+    }
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <vector>
+#include "common.hpp"
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+// tells which of a set of files were rewritten, polled once a frame and never
+// blocks. On linux this is inotify on the directories: editors that save by
+// writing a temp file and renaming it over the old one replace the inode, so
+// watching the file itself would stop after the first save. Elsewhere it
+// compares modification times on every poll.
+struct FileWatcher {
+    struct WatchedFile {
+        std::string path;
+        std::string dir;
+        std::string file_name;
+        int watch = -1;
+        std::filesystem::file_time_type mtime = {};
+    };
+
+    std::vector<WatchedFile> files;
+    int fd = -1;
+    std::vector<char> buffer;
+
+    FileWatcher();
+    ~FileWatcher();
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    // index of the file in changed, or -1 if it can't be watched
+    int watch(const std::string& path);
+
+    // appends the index of every file written and closed or moved into place
+    // since the last poll, each at most once
+    void poll(std::vector<u32>& changed);
+};
+
+FileWatcher::FileWatcher() {
+#if defined(__linux__)
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    buffer.resize(64 * 1024);
+#endif
+}
+
+FileWatcher::~FileWatcher() {
+#if defined(__linux__)
+    if (fd >= 0) close(fd);
+#endif
+}
+
+int FileWatcher::watch(const std::string& path) {
+    std::error_code error;
+    std::filesystem::path absolute = std::filesystem::absolute(path, error);
+    if (error) return -1;
+
+    WatchedFile file;
+    file.path = path;
+    file.dir = absolute.parent_path().string();
+    file.file_name = absolute.filename().string();
+    file.mtime = std::filesystem::last_write_time(absolute, error);
+#if defined(__linux__)
+    if (fd < 0) return -1;
+    // one watch per directory, adding it again returns the same descriptor
+    file.watch = inotify_add_watch(fd, file.dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (file.watch < 0) return -1;
+#endif
+    files.push_back(std::move(file));
+    return (int)files.size() - 1;
+}
+
+void FileWatcher::poll(std::vector<u32>& changed) {
+    size_t first = changed.size();
+    auto note = [&](u32 index) {
+        if (std::find(changed.begin() + first, changed.end(), index) == changed.end()) changed.push_back(index);
+    };
+#if defined(__linux__)
+    if (fd < 0) return;
+    while (true) {
+        ssize_t length = read(fd, buffer.data(), buffer.size());
+        if (length <= 0) break;
+        for (ssize_t offset = 0; offset < length;) {
+            const inotify_event* event = (const inotify_event*)(buffer.data() + offset);
+            offset += sizeof(inotify_event) + event->len;
+            if (event->len == 0) continue;
+            for (u32 i = 0; i < files.size(); ++i) {
+                if (files[i].watch == event->wd && files[i].file_name == event->name) note(i);
+            }
+        }
+    }
+#else
+    for (u32 i = 0; i < files.size(); ++i) {
+        std::error_code error;
+        std::filesystem::file_time_type mtime = std::filesystem::last_write_time(files[i].path, error);
+        if (error || mtime == files[i].mtime) continue;
+        files[i].mtime = mtime;
+        note(i);
+    }
+#endif
+}
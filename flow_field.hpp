@@ -0,0 +1,259 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <vector>
+#include "raylib.h"
+#include "raymath.h"
+#include "common.hpp"
+
+// a rectangle that got blocked or freed since the field was computed
+struct FlowChange {
+    Rectangle rec;
+    bool blocked;
+};
+
+// grid of steering directions towards a single goal cell, blocked cells are
+// routed around. Distances are 4-neighbour steps, steering picks the lowest of
+// the 8 neighbours without cutting blocked corners.
+struct FlowField {
+    static constexpr u32 UNREACHABLE = UINT32_MAX;
+    static constexpr uint8_t NO_DIRECTION = 8;
+
+    u32 columns = 0;
+    u32 rows = 0;
+    float cell_size = 8.f;
+    u32 goal = 0;
+
+    std::vector<u32> distance;
+    std::vector<uint8_t> blocked;
+    std::vector<uint8_t> direction;
+
+    void init(float width, float height, float cell_size);
+
+    u32 cell_at(Vector2 position) const;
+
+    Vector2 cell_center(u32 cell) const;
+
+    // marks every cell the rectangle overlaps, returns the cells that changed
+    void set_blocked(Rectangle rec, bool value, std::vector<u32>& changed);
+
+    // full breadth first search from goal
+    void compute(Vector2 goal_position);
+
+    // repairs distances and directions after set_blocked, only the cells
+    // whose shortest path went through the changed ones are touched
+    void repair(const std::vector<u32>& changed);
+
+    // unit steering vector, zero at the goal or where the goal can't be reached
+    Vector2 get_direction(Vector2 position) const;
+
+    u32 get_distance(Vector2 position) const;
+
+    void update_direction(u32 cell);
+};
+
+static constexpr int FLOW_DX[8] = {1, -1, 0, 0, 1, 1, -1, -1};
+static constexpr int FLOW_DY[8] = {0, 0, 1, -1, 1, -1, 1, -1};
+static constexpr float FLOW_DIAGONAL = 0.70710678f;
+static constexpr Vector2 FLOW_DIRECTIONS[9] = {
+    {1.f, 0.f}, {-1.f, 0.f}, {0.f, 1.f}, {0.f, -1.f},
+    {FLOW_DIAGONAL, FLOW_DIAGONAL}, {FLOW_DIAGONAL, -FLOW_DIAGONAL},
+    {-FLOW_DIAGONAL, FLOW_DIAGONAL}, {-FLOW_DIAGONAL, -FLOW_DIAGONAL},
+    {0.f, 0.f},
+};
+
+void FlowField::init(float width, float height, float cell_size) {
+    this->cell_size = cell_size;
+    columns = std::max(1u, (u32)ceilf(width / cell_size));
+    rows = std::max(1u, (u32)ceilf(height / cell_size));
+    size_t count = (size_t)columns * rows;
+    distance.assign(count, UNREACHABLE);
+    blocked.assign(count, 0);
+    direction.assign(count, NO_DIRECTION);
+}
+
+u32 FlowField::cell_at(Vector2 position) const {
+    int x = Clamp(floorf(position.x / cell_size), 0.f, (float)columns - 1);
+    int y = Clamp(floorf(position.y / cell_size), 0.f, (float)rows - 1);
+    return (u32)y * columns + (u32)x;
+}
+
+Vector2 FlowField::cell_center(u32 cell) const {
+    return {((cell % columns) + 0.5f) * cell_size, ((cell / columns) + 0.5f) * cell_size};
+}
+
+void FlowField::set_blocked(Rectangle rec, bool value, std::vector<u32>& changed) {
+    int x0 = std::max(0, (int)floorf(rec.x / cell_size));
+    int y0 = std::max(0, (int)floorf(rec.y / cell_size));
+    int x1 = std::min((int)columns - 1, (int)ceilf((rec.x + rec.width) / cell_size) - 1);
+    int y1 = std::min((int)rows - 1, (int)ceilf((rec.y + rec.height) / cell_size) - 1);
+    for (int y = y0; y <= y1; ++y) {
+        for (int x = x0; x <= x1; ++x) {
+            u32 cell = (u32)y * columns + (u32)x;
+            if (blocked[cell] == (uint8_t)value) continue;
+            blocked[cell] = value;
+            changed.push_back(cell);
+        }
+    }
+}
+
+void FlowField::compute(Vector2 goal_position) {
+    std::fill(distance.begin(), distance.end(), UNREACHABLE);
+    goal = cell_at(goal_position);
+
+    std::vector<u32> frontier;
+    frontier.reserve(columns + rows);
+    std::vector<u32> next;
+    next.reserve(columns + rows);
+    if (!blocked[goal]) {
+        distance[goal] = 0;
+        frontier.push_back(goal);
+    }
+
+    u32 step = 0;
+    while (!frontier.empty()) {
+        step++;
+        next.clear();
+        for (u32 cell : frontier) {
+            int x = cell % columns;
+            int y = cell / columns;
+            for (int d = 0; d < 4; ++d) {
+                int nx = x + FLOW_DX[d];
+                int ny = y + FLOW_DY[d];
+                if (nx < 0 || ny < 0 || nx >= (int)columns || ny >= (int)rows) continue;
+                u32 n = (u32)ny * columns + (u32)nx;
+                if (blocked[n] || distance[n] != UNREACHABLE) continue;
+                distance[n] = step;
+                next.push_back(n);
+            }
+        }
+        std::swap(frontier, next);
+    }
+
+    for (u32 cell = 0; cell < distance.size(); ++cell) {
+        update_direction(cell);
+    }
+}
+
+void FlowField::update_direction(u32 cell) {
+    if (blocked[cell] || distance[cell] == UNREACHABLE || distance[cell] == 0) {
+        direction[cell] = NO_DIRECTION;
+        return;
+    }
+    int x = cell % columns;
+    int y = cell / columns;
+    u32 best = distance[cell];
+    uint8_t best_dir = NO_DIRECTION;
+    for (int d = 0; d < 8; ++d) {
+        int nx = x + FLOW_DX[d];
+        int ny = y + FLOW_DY[d];
+        if (nx < 0 || ny < 0 || nx >= (int)columns || ny >= (int)rows) continue;
+        u32 n = (u32)ny * columns + (u32)nx;
+        if (blocked[n] || distance[n] >= best) continue;
+        // no squeezing diagonally past a blocked corner
+        if (d >= 4 && (blocked[(u32)y * columns + nx] || blocked[(u32)ny * columns + x])) continue;
+        best = distance[n];
+        best_dir = d;
+    }
+    direction[cell] = best_dir;
+}
+
+void FlowField::repair(const std::vector<u32>& changed) {
+    typedef std::pair<u32, u32> Entry; // distance, cell
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open;
+    std::vector<u32> touched;
+
+    auto neighbour = [this](u32 cell, int d, u32& out) {
+        int nx = (int)(cell % columns) + FLOW_DX[d];
+        int ny = (int)(cell / columns) + FLOW_DY[d];
+        if (nx < 0 || ny < 0 || nx >= (int)columns || ny >= (int)rows) return false;
+        out = (u32)ny * columns + (u32)nx;
+        return true;
+    };
+
+    // 1. invalidate every cell that only had a shortest path through a newly blocked one,
+    // in order of old distance so every lost support is known before it's checked
+    std::vector<Entry> invalid;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> pending;
+    for (u32 cell : changed) {
+        if (blocked[cell] && distance[cell] != UNREACHABLE) {
+            pending.push({distance[cell], cell});
+            invalid.push_back({distance[cell], cell});
+            distance[cell] = UNREACHABLE;
+            touched.push_back(cell);
+        }
+    }
+    while (!pending.empty()) {
+        u32 old_distance = pending.top().first;
+        u32 cell = pending.top().second;
+        pending.pop();
+        for (int d = 0; d < 4; ++d) {
+            u32 n;
+            if (!neighbour(cell, d, n)) continue;
+            if (blocked[n] || distance[n] != old_distance + 1) continue;
+            bool supported = false;
+            for (int d2 = 0; d2 < 4 && !supported; ++d2) {
+                u32 m;
+                if (neighbour(n, d2, m) && !blocked[m] && distance[m] == old_distance) supported = true;
+            }
+            if (supported) continue;
+            pending.push({distance[n], n});
+            invalid.push_back({distance[n], n});
+            distance[n] = UNREACHABLE;
+            touched.push_back(n);
+        }
+    }
+
+    // 2. seed from the valid border of the invalidated region and from unblocked cells
+    auto seed = [&](u32 cell) {
+        if (blocked[cell]) return;
+        u32 best = cell == goal ? 0 : UNREACHABLE;
+        for (int d = 0; d < 4; ++d) {
+            u32 n;
+            if (neighbour(cell, d, n) && !blocked[n] && distance[n] != UNREACHABLE) {
+                best = std::min(best, distance[n] + 1);
+            }
+        }
+        if (best < distance[cell]) {
+            distance[cell] = best;
+            open.push({best, cell});
+            touched.push_back(cell);
+        }
+    };
+    for (const Entry& entry : invalid) seed(entry.second);
+    for (u32 cell : changed) seed(cell);
+
+    // 3. dijkstra over the affected cells, unit costs so distances only shrink
+    while (!open.empty()) {
+        Entry top = open.top();
+        open.pop();
+        if (top.first != distance[top.second]) continue;
+        for (int d = 0; d < 4; ++d) {
+            u32 n;
+            if (!neighbour(top.second, d, n) || blocked[n]) continue;
+            if (top.first + 1 < distance[n]) {
+                distance[n] = top.first + 1;
+                open.push({distance[n], n});
+                touched.push_back(n);
+            }
+        }
+    }
+
+    for (u32 cell : changed) touched.push_back(cell);
+    for (u32 cell : touched) {
+        update_direction(cell);
+        for (int d = 0; d < 8; ++d) {
+            u32 n;
+            if (neighbour(cell, d, n)) update_direction(n);
+        }
+    }
+}
+
+Vector2 FlowField::get_direction(Vector2 position) const {
+    return FLOW_DIRECTIONS[direction[cell_at(position)]];
+}
+
+u32 FlowField::get_distance(Vector2 position) const {
+    return distance[cell_at(position)];
+}
@@ -0,0 +1,112 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory_resource>
+#include <vector>
+#include "common.hpp"
+
+// bump allocator for memory that dies with the frame, deallocate does nothing
+// and reset drops everything at once. When the chunk runs out it chains more
+// from upstream, the next reset folds them into one chunk as big as the whole
+// frame was, so a steady frame never goes to the heap.
+struct FrameArena : std::pmr::memory_resource {
+    std::pmr::memory_resource* upstream;
+    std::byte* chunk = nullptr;
+    size_t capacity = 0;
+    size_t used = 0;
+    // full chunks of this frame, freed on reset
+    std::vector<std::pair<std::byte*, size_t>> retired;
+    size_t retired_used = 0;
+    // most bytes any frame used so far
+    size_t peak = 0;
+
+    FrameArena(size_t initial_capacity = 64 * 1024, std::pmr::memory_resource* upstream = std::pmr::new_delete_resource());
+    ~FrameArena();
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    // everything handed out so far becomes invalid
+    void reset();
+
+    size_t get_used() const { return retired_used + used; }
+
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void*, size_t, size_t) override {}
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
+
+FrameArena::FrameArena(size_t initial_capacity, std::pmr::memory_resource* upstream) : upstream(upstream) {
+    capacity = initial_capacity;
+    chunk = (std::byte*)upstream->allocate(capacity, alignof(std::max_align_t));
+}
+
+FrameArena::~FrameArena() {
+    for (auto [retired_chunk, retired_capacity] : retired) upstream->deallocate(retired_chunk, retired_capacity, alignof(std::max_align_t));
+    upstream->deallocate(chunk, capacity, alignof(std::max_align_t));
+}
+
+// offset of the first aligned byte at or after offset
+static size_t align_in_chunk(const std::byte* chunk, size_t offset, size_t alignment) {
+    uintptr_t base = (uintptr_t)chunk;
+    return ((base + offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+}
+
+void* FrameArena::do_allocate(size_t bytes, size_t alignment) {
+    size_t start = align_in_chunk(chunk, used, alignment);
+    if (start + bytes > capacity) {
+        retired.push_back({chunk, capacity});
+        retired_used += used;
+        capacity = std::max(capacity * 2, bytes + alignment);
+        chunk = (std::byte*)upstream->allocate(capacity, alignof(std::max_align_t));
+        start = align_in_chunk(chunk, 0, alignment);
+    }
+    used = start + bytes;
+    return chunk + start;
+}
+
+void FrameArena::reset() {
+    peak = std::max(peak, get_used());
+    if (!retired.empty()) {
+        for (auto [retired_chunk, retired_capacity] : retired) upstream->deallocate(retired_chunk, retired_capacity, alignof(std::max_align_t));
+        retired.clear();
+        upstream->deallocate(chunk, capacity, alignof(std::max_align_t));
+        // room for the busiest frame so far with some slack
+        capacity = std::bit_ceil(peak + peak / 2);
+        chunk = (std::byte*)upstream->allocate(capacity, alignof(std::max_align_t));
+    }
+    retired_used = 0;
+    used = 0;
+}
+
+// one arena per thread. Only the main thread resets its arena, so only the
+// main thread may use it, the job pool doesn't
+FrameArena& frame_arena() {
+    thread_local FrameArena arena;
+    return arena;
+}
+
+// end of frame, nothing may still hold frame memory
+void reset_frame_arena() {
+    frame_arena().reset();
+}
+
+// printf into this thread's arena. Unlike TextFormat there's no ring of shared
+// buffers to wrap around, the text stays valid until the frame ends
+const char* frame_format(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    va_list size_args;
+    va_copy(size_args, args);
+    int length = vsnprintf(nullptr, 0, format, size_args);
+    va_end(size_args);
+    char* text = (char*)frame_arena().allocate(length + 1, 1);
+    vsnprintf(text, length + 1, format, args);
+    va_end(args);
+    return text;
+}
@@ -8,27 +8,28 @@
 #include <cassert>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <type_traits>
+#include <chrono>
+#include <future>
+#include "noise.hpp"
+#include "jobs.hpp"
+#include "flow_field.hpp"
+#include "spatial_grid.hpp"
+#include "path_progress.hpp"
+#include "alloc_tracker.hpp"
+#include "frame_arena.hpp"
+#include "logger.hpp"
+#include "ground_tiles.hpp"
 
 typedef uint64_t u64;
 typedef uint32_t u32;
 typedef uint8_t  byte;
 
-// tools
-enum Log_Level {
-    NO_LOG, LOW, FULL, 
-};
-
-
-template <class T>
-void log_var(T var, const char* name = nullptr, Log_Level log_lvl = FULL) {
-    if (log_lvl == NO_LOG) return;
-
-    if (name && strlen(name) > 0) {
-        std::cout << name << ":\n";
-    }
-    std::cout << var << "\n";
-}
-
 // TODO:: REREFACTOR FUNCTIONS
 template <class T>
 static void remove_inactive_elements(std::vector<T>& array);
@@ -37,6 +38,10 @@ static Vector2 get_rec_center(Rectangle rec);
 
 static Rectangle to_rec(const Vector2& v1, const Vector2& v2);
 
+// circle moving from start to start + delta against a resting rectangle,
+// toi is the fraction of delta travelled at first contact
+static bool sweep_circle_rec(Vector2 start, Vector2 delta, float radius, Rectangle rec, float& toi);
+
 // could go boom boom
 template<class T>
 void write_to_blob(byte* blob, size_t& offset, T val) {
@@ -51,19 +56,58 @@ void write_to_blob(byte* blob, size_t& offset, T* val, size_t size) {
     offset += size;
 }
 
+// size of the blob this thread is reading, set by load_from_file. Reads past
+// it yield zeros and leave offset at BLOB_OVERRUN, so a truncated file fails
+// the final size check instead of running off the buffer
+static constexpr size_t BLOB_OVERRUN = SIZE_MAX;
+static thread_local size_t blob_read_end = SIZE_MAX;
+
+static bool blob_has(size_t offset, size_t size) {
+    return offset <= blob_read_end && size <= blob_read_end - offset;
+}
+
 template<class T>
 void read_from_blob(byte* blob, size_t& offset, T& out) {
     size_t size = sizeof(T);
+    if (!blob_has(offset, size)) {
+        memset((void*)&out, 0, size);
+        offset = BLOB_OVERRUN;
+        return;
+    }
     memcpy(&out, blob + offset, size); 
     offset += size;
 }
 
 template<class T>
 void read_from_blob(byte* blob, size_t& offset, T* out, size_t size) {
+    if (!blob_has(offset, size)) {
+        if (size) memset((void*)out, 0, size);
+        offset = BLOB_OVERRUN;
+        return;
+    }
     memcpy(out, blob + offset, size); 
     offset += size;
 }
 
+// why the read stopped when it wasn't the end of the blob, see reject_blob
+static thread_local const char* blob_read_error = nullptr;
+
+// for values the file can't have, like an unknown type. The read fails like
+// a truncated one but load_from_file logs what
+static void reject_blob(size_t& offset, const char* what) {
+    if (offset != BLOB_OVERRUN) blob_read_error = what;
+    offset = BLOB_OVERRUN;
+}
+
+// a count that can't fit in what's left of the blob is garbage, don't
+// allocate for it
+static size_t checked_blob_count(size_t& offset, size_t count, size_t min_element_size) {
+    // count <= bytes left, so the product can't overflow
+    if (count == 0 || (blob_has(offset, count) && blob_has(offset, count * min_element_size))) return count;
+    offset = BLOB_OVERRUN;
+    return 0;
+}
+
 
 void string_to_blob(byte* blob, size_t& offset, const std::string& string) {
     write_to_blob(blob, offset, string.size());
@@ -81,14 +125,15 @@ template<class T>
 void array_from_blob(byte* blob, size_t& offset, std::vector<T>& array) {
     size_t size = 0; 
     read_from_blob(blob, offset, size);
+    size = checked_blob_count(offset, size, sizeof(T));
     array.resize(size);
-    read_from_blob(blob, offset, &array[0], size * sizeof(T));
+    read_from_blob(blob, offset, array.data(), size * sizeof(T));
 }
 
 template<class T>
 void struct_array_to_blob(byte* blob, size_t& offset, const std::vector<T>& array) {
     write_to_blob(blob, offset, array.size());
-    for(T t : array) {
+    for(const T& t : array) {
         t.save_to_blob(blob, offset);
     }
 }
@@ -97,6 +142,7 @@ template<class T>
 void struct_array_from_blob(byte* blob, size_t& offset, std::vector<T>& array) {
     size_t size = 0;
     read_from_blob(blob, offset, size);
+    size = checked_blob_count(offset, size, 1);
     array.resize(size);
     for (T& t : array) {
         t.load_from_blob(blob, offset);
@@ -106,30 +152,59 @@ void struct_array_from_blob(byte* blob, size_t& offset, std::vector<T>& array) {
 void string_from_blob(byte* blob, size_t& offset, std::string& out) {
     size_t size;
     read_from_blob(blob, offset, size);
+    size = checked_blob_count(offset, size, 1);
     out.resize(size);
-    read_from_blob(blob, offset, &out[0], size);
+    read_from_blob(blob, offset, out.data(), size);
 }
 
 struct Level;
 
 struct Map {
-    Texture ground_tex;
-    u64 width;
-    u64 height;
+    u64 width = 0;
+    u64 height = 0;
+    // the ground is generated from this in tiles as it comes into view, see
+    // ground_tiles. Only the seed gets saved
+    u32 ground_seed = 0;
     float road_width = 10.f;
     std::vector<Vector2> waypoints;
     std::vector<Rectangle> occupied_areas;
 
+    // maze maps steer enemies around towers towards the last waypoint. The field
+    // is shared and only ever replaced whole, see Level::update_flow_field
+    bool use_flow_field = false;
+    float flow_cell_size = 8.f;
+    std::shared_ptr<const FlowField> flow_field;
+
+    // empty map for loading, nothing reserved
+    Map() = default;
+
     Map(Rectangle bounds);
 
-    void ground_tex_from_image(const Image& img);
+    // move only, copies go through clone
+    Map(const Map&) = delete;
+    Map& operator=(const Map&) = delete;
+    Map(Map&&) = default;
+    Map& operator=(Map&&) = default;
+
+    // explicit deep copy, the flow field stays shared
+    Map clone() const;
+
+    // everything that gets saved is equal
+    bool same_as(const Map& other) const;
+
+    // drops the last occupied area equal to rec, false if there is none
+    bool remove_rec(Rectangle rec);
 
     void add_rec(Rectangle rec);
 
+    // full recompute from occupied_areas, blocking
+    void build_flow_field();
+
     bool check_free(Rectangle rec) const ;
 
     size_t get_byte_size() const {
-        size_t num_bytes = sizeof(width) + sizeof(height) + sizeof(road_width);
+        size_t num_bytes = sizeof(width) + sizeof(height) + sizeof(ground_seed) + sizeof(road_width);
+        num_bytes += sizeof(use_flow_field) + sizeof(flow_cell_size);
         //waypoints.size
         num_bytes += sizeof(size_t);
         //occupied_areas.size
@@ -143,7 +218,10 @@ struct Map {
         size_t local_offset = offset;
         write_to_blob(blob, offset, width) ;
         write_to_blob(blob, offset, height);
+        write_to_blob(blob, offset, ground_seed);
         write_to_blob(blob, offset, road_width);
+        write_to_blob(blob, offset, use_flow_field);
+        write_to_blob(blob, offset, flow_cell_size);
 
         array_to_blob(blob, offset, waypoints);
         array_to_blob(blob, offset, occupied_areas);
@@ -155,7 +233,10 @@ struct Map {
     void load_from_blob(byte* blob, size_t& offset) {
         read_from_blob(blob, offset, width);
         read_from_blob(blob, offset, height);
+        read_from_blob(blob, offset, ground_seed);
         read_from_blob(blob, offset, road_width);
+        read_from_blob(blob, offset, use_flow_field);
+        read_from_blob(blob, offset, flow_cell_size);
 
         array_from_blob(blob, offset, waypoints);
         array_from_blob(blob, offset, occupied_areas);
@@ -163,29 +244,57 @@ struct Map {
 
 };
 
-enum Enemy_Type {
+enum Enemy_Type : uint8_t {
     CHICKEN, ENEMY_TYPE_MAX
 };
 
+// as written in wave files
+static const char* ENEMY_TYPE_NAMES[ENEMY_TYPE_MAX] = {"chicken"};
+
+// stats shared by every enemy of a type, instances only keep what changes
+struct EnemyArchetype {
+    float hp;
+    float speed;
+    // what a leak costs the player
+    float damage;
+    Vector2 size;
+};
+
+static constexpr EnemyArchetype ENEMY_ARCHETYPES[ENEMY_TYPE_MAX] = {
+    /* CHICKEN */ {.hp = 100.f, .speed = 100.f, .damage = 1.f, .size = {10.f, 10.f}},
+};
+
+// widest fields first so nothing gets padded, see the static_assert below
 struct Enemy {
-    bool active = true;
-    float hp = 100.f;
-    float speed = 100.f;
-    float damage = 1.f;
-    Enemy_Type type = CHICKEN;
     Rectangle boundary = {0.f, 0.f, 10.f, 10.f};
     Vector2 direction = {1.f, 0.f};
-    u64 next_waypoint = 0;
-    u64 id;
+    float hp = ENEMY_ARCHETYPES[CHICKEN].hp;
+    // per instance modifier on the archetype speed
+    float speed_scale = 1.f;
+    // index into Level::enemy_records
+    u32 id = 0;
+    u32 next_waypoint = 0;
+    Enemy_Type type = CHICKEN;
+    bool active : 1 = true;
+    bool hit : 1 = false;
+
+    // full hp and the archetype size
+    static Enemy from_type(Enemy_Type type);
 
-    bool hit = false;
+    const EnemyArchetype& get_archetype() const { return ENEMY_ARCHETYPES[type]; }
+
+    float get_speed() const { return get_archetype().speed * speed_scale; }
 
     void set_position(Vector2 pos);
 
     Vector2 get_position() const;
     Vector2 get_center() const;
 
-    void update(const std::vector<Vector2>& waypoints);
+    // field is the level's flow field, null to follow the waypoints
+    void update(const Map& map, const FlowField* field, float dt);
+
+    // false where the field has no direction, waypoints take over then
+    bool follow_flow_field(const FlowField& field, float dt);
 
     void find_nearest_waypoint(const std::vector<Vector2>& waypoints);
 
@@ -193,54 +302,58 @@ struct Enemy {
 
     size_t get_byte_size() const {
         size_t size = 0;
-        size += sizeof(active);
+        size += sizeof(bool);
         size += sizeof(hp);
-        size += sizeof(speed);
-        size += sizeof(damage);
+        size += sizeof(speed_scale);
         size += sizeof(type);
         size += sizeof(boundary);
         size += sizeof(direction);
         size += sizeof(next_waypoint);
         size += sizeof(id);
-        size += sizeof(hit);
+        size += sizeof(bool);
         return size;
     }
 
     void save_to_blob(byte* blob, size_t& offset) const {
         size_t local_offset = offset;
 
-        write_to_blob(blob, offset, active);
+        write_to_blob(blob, offset, (bool)active);
         write_to_blob(blob, offset, hp);
-        write_to_blob(blob, offset, speed);
-        write_to_blob(blob, offset, damage);
+        write_to_blob(blob, offset, speed_scale);
         write_to_blob(blob, offset, type);
         write_to_blob(blob, offset, boundary);
         write_to_blob(blob, offset, direction);
         write_to_blob(blob, offset, next_waypoint);
         write_to_blob(blob, offset, id);
-        write_to_blob(blob, offset, hit);
+        write_to_blob(blob, offset, (bool)hit);
 
         local_offset = offset - local_offset;
         assert(local_offset == get_byte_size());
     }
 
     void load_from_blob(byte* blob, size_t& offset) {
-        read_from_blob(blob, offset, active);
+        // no references to bitfields
+        bool flag;
+        read_from_blob(blob, offset, flag);
+        active = flag;
         read_from_blob(blob, offset, hp);
-        read_from_blob(blob, offset, speed);
-        read_from_blob(blob, offset, damage);
+        read_from_blob(blob, offset, speed_scale);
         read_from_blob(blob, offset, type);
+        if (type >= ENEMY_TYPE_MAX) reject_blob(offset, "unknown enemy type");
         read_from_blob(blob, offset, boundary);
         read_from_blob(blob, offset, direction);
         read_from_blob(blob, offset, next_waypoint);
         read_from_blob(blob, offset, id);
-        read_from_blob(blob, offset, hit);
+        read_from_blob(blob, offset, flag);
+        hit = flag;
     }
 };
 
 struct EnemyRecord {
     bool active;
     Vector2 center;
+    // speed along the last step, for lead targeting. Not saved, the next tick sets it
+    Vector2 velocity = {0.f, 0.f};
 
     size_t get_byte_size() const {
         return sizeof(active) + sizeof(center);
@@ -262,30 +375,67 @@ struct EnemyRecord {
     }
 };
 
-enum Projectile_Type {
-    STRAIGHT, SEEK
+enum Projectile_Type : uint8_t {
+    STRAIGHT, SEEK,
+    // flies straight, damages everything within splash_radius of the impact
+    SPLASH,
+    PROJECTILE_TYPE_MAX
+};
+
+struct ProjectileArchetype {
+    float speed;
+    float radius;
+    float damage;
+    // > 0 => everything within it takes damage on impact
+    float splash_radius;
 };
 
+static constexpr ProjectileArchetype PROJECTILE_ARCHETYPES[PROJECTILE_TYPE_MAX] = {
+    /* STRAIGHT */ {.speed = 500.f, .radius = 2.f, .damage = 2.f, .splash_radius = 0.f},
+    /* SEEK     */ {.speed = 500.f, .radius = 2.f, .damage = 2.f, .splash_radius = 0.f},
+    /* SPLASH   */ {.speed = 500.f, .radius = 2.f, .damage = 2.f, .splash_radius = 30.f},
+};
+
+// damage dealt during a tick. Bullets only read enemies and emit these, they
+// are applied in one pass once every bullet has moved.
+struct DamageEvent {
+    // index into Level::enemies, valid until update_enemies compacts the array
+    u32 enemy;
+    // index into Level::towers for the kill stats, NO_TOWER if nobody gets it
+    u32 tower;
+    float damage;
+};
+
+
 struct Projectile {
-    bool active = true;
-    float speed = 500.f; 
-    float radius = 2.f;
-    float damage = 2.f;
-    u64 target_id;
-    bool target_lost = false;
-    Vector2 position;
-    Vector2 direction;
+    Vector2 position = {0.f, 0.f};
+    Vector2 direction = {0.f, 0.f};
+    // archetype damage plus the tower's
+    float damage = 0.f;
+    u32 target_id = 0;
+    // index into Level::towers of the tower that fired
+    u32 tower_index = 0;
     Projectile_Type type = STRAIGHT;
+    bool active : 1 = true;
+    bool target_lost : 1 = false;
+
+    // returns true on a hit, the damage to the enemy hit directly goes to events
+    bool update(const std::vector<Enemy>& enemies, const std::vector<EnemyRecord>& enemy_records, const SpatialGrid& enemy_grid,
+                Rectangle game_boundary, float dt, std::vector<DamageEvent>& events);
+
+    // update with the archetype known at compile time
+    template<Projectile_Type TYPE>
+    bool update_as(const std::vector<Enemy>& enemies, const std::vector<EnemyRecord>& enemy_records, const SpatialGrid& enemy_grid,
+                   Rectangle game_boundary, float dt, std::vector<DamageEvent>& events);
 
-    void update(std::vector<Enemy>& enemies, std::vector<EnemyRecord>& enemy_records, Rectangle game_boundary);
+    const ProjectileArchetype& get_archetype() const { return PROJECTILE_ARCHETYPES[type]; }
     
     size_t get_byte_size() const {
-        size_t size = sizeof(active);
-        size += sizeof(speed);
-        size += sizeof(radius);
+        size_t size = sizeof(bool);
         size += sizeof(damage);
         size += sizeof(target_id);
-        size += sizeof(target_lost);
+        size += sizeof(tower_index);
+        size += sizeof(bool);
         size += sizeof(position);
         size += sizeof(direction);
         size += sizeof(type);
@@ -295,12 +445,11 @@ struct Projectile {
     void save_to_blob(byte* blob, size_t& offset) const {
         size_t local_offset = offset;
 
-        write_to_blob(blob, offset, active);
-        write_to_blob(blob, offset, speed);
-        write_to_blob(blob, offset, radius);
+        write_to_blob(blob, offset, (bool)active);
         write_to_blob(blob, offset, damage);
         write_to_blob(blob, offset, target_id);
-        write_to_blob(blob, offset, target_lost);
+        write_to_blob(blob, offset, tower_index);
+        write_to_blob(blob, offset, (bool)target_lost);
         write_to_blob(blob, offset, position);
         write_to_blob(blob, offset, direction);
         write_to_blob(blob, offset, type);
@@ -310,39 +459,77 @@ struct Projectile {
     }
 
     void load_from_blob(byte* blob, size_t& offset) {
-        read_from_blob(blob, offset, active);
-        read_from_blob(blob, offset, speed);
-        read_from_blob(blob, offset, radius);
+        bool flag;
+        read_from_blob(blob, offset, flag);
+        active = flag;
         read_from_blob(blob, offset, damage);
         read_from_blob(blob, offset, target_id);
-        read_from_blob(blob, offset, target_lost);
+        read_from_blob(blob, offset, tower_index);
+        read_from_blob(blob, offset, flag);
+        target_lost = flag;
         read_from_blob(blob, offset, position);
         read_from_blob(blob, offset, direction);
         read_from_blob(blob, offset, type);
+        if (type >= PROJECTILE_TYPE_MAX) reject_blob(offset, "unknown projectile type");
     }
 
 };
 
-enum Tower_Type {
-    TOWER_BASIC, TOWER_SEEK  
+enum Tower_Type : uint8_t {
+    TOWER_BASIC, TOWER_SEEK, 
+    // straight shots that damage everything within splash_radius of the impact
+    TOWER_SPLASH,
+    // no projectiles, every shot damages all enemies in range
+    TOWER_AURA,
+    TOWER_TYPE_MAX
 };
 
-struct Tower {
-    float hp = 100.f;
-    float damage = 10.f;
-    float range = 100.f;
-    float reload_time = 0.2f;
-    float time_since_shot = reload_time;
-    float turn_speed = 10.f;
-    Tower_Type type = TOWER_SEEK;
+struct TowerArchetype {
+    float hp;
+    float damage;
+    float range;
+    float reload_time;
+    float turn_speed;
+    // unused by TOWER_AURA
+    Projectile_Type projectile;
+};
 
+static constexpr TowerArchetype TOWER_ARCHETYPES[TOWER_TYPE_MAX] = {
+    /* TOWER_BASIC  */ {.hp = 100.f, .damage = 10.f, .range = 100.f, .reload_time = 0.2f, .turn_speed = 0.1f, .projectile = STRAIGHT},
+    /* TOWER_SEEK   */ {.hp = 100.f, .damage = 10.f, .range = 100.f, .reload_time = 0.2f, .turn_speed = 10.f, .projectile = SEEK},
+    /* TOWER_SPLASH */ {.hp = 100.f, .damage = 10.f, .range = 100.f, .reload_time = 0.2f, .turn_speed = 10.f, .projectile = SPLASH},
+    /* TOWER_AURA   */ {.hp = 100.f, .damage = 10.f, .range = 100.f, .reload_time = 0.2f, .turn_speed = 10.f, .projectile = STRAIGHT},
+};
+
+// per instance multipliers on the archetype, 1 = stock
+struct TowerModifiers {
+    float damage = 1.f;
+    float range = 1.f;
+    float reload_time = 1.f;
+};
+
+// kill counts live in LevelStats::tower_kills, nothing here is stats only
+struct Tower {
     Vector2 position = {0.f, 0.f};
     Vector2 size = {10.f, 10.f};
     Vector2 direction = {10.f, 10.f};
-    u64 target_id;
-    bool target_lock = false;
+    // ready on the first update whatever the reload time
+    float time_since_shot = INFINITY;
+    TowerModifiers modifiers;
+    float hp = 100.f;
+    u32 target_id = 0;
+    Tower_Type type = TOWER_SEEK;
+    bool target_lock : 1 = false;
+
+    void update(const std::vector<Enemy>& enemies, const std::vector<EnemyRecord>& enemy_records, const SpatialGrid& enemy_grid, float dt);
+
+    const TowerArchetype& get_archetype() const { return TOWER_ARCHETYPES[type]; }
+
+    float get_damage() const { return get_archetype().damage * modifiers.damage; }
 
-    void update(const std::vector<Enemy>& enemies, const std::vector<EnemyRecord>& enemy_records);
+    float get_range() const { return get_archetype().range * modifiers.range; }
+
+    float get_reload_time() const { return get_archetype().reload_time * modifiers.reload_time; }
 
     bool shot_ready();
 
@@ -355,17 +542,14 @@ struct Tower {
     size_t get_byte_size() const {
         size_t size = 0;
         size += sizeof(hp);
-        size += sizeof(damage);
-        size += sizeof(range);
-        size += sizeof(reload_time);
         size += sizeof(time_since_shot);
-        size += sizeof(turn_speed);
         size += sizeof(type);
+        size += sizeof(modifiers);
         size += sizeof(position);
         size += sizeof(this->size);
         size += sizeof(direction);
         size += sizeof(target_id);
-        size += sizeof(target_lock);
+        size += sizeof(bool);
         return size;
     } 
 
@@ -373,17 +557,14 @@ struct Tower {
         size_t local_offset = offset;        
 
         write_to_blob(blob, offset, hp);
-        write_to_blob(blob, offset, damage);
-        write_to_blob(blob, offset, range);
-        write_to_blob(blob, offset, reload_time);
         write_to_blob(blob, offset, time_since_shot);
-        write_to_blob(blob, offset, turn_speed);
         write_to_blob(blob, offset, type);
+        write_to_blob(blob, offset, modifiers);
         write_to_blob(blob, offset, position);
         write_to_blob(blob, offset, size);
         write_to_blob(blob, offset, direction);
         write_to_blob(blob, offset, target_id);
-        write_to_blob(blob, offset, target_lock);
+        write_to_blob(blob, offset, (bool)target_lock);
 
         local_offset = offset - local_offset;
         assert(local_offset == get_byte_size());
@@ -391,17 +572,17 @@ struct Tower {
 
     void load_from_blob(byte* blob, size_t& offset) {
         read_from_blob(blob, offset, hp);
-        read_from_blob(blob, offset, damage);
-        read_from_blob(blob, offset, range);
-        read_from_blob(blob, offset, reload_time);
         read_from_blob(blob, offset, time_since_shot);
-        read_from_blob(blob, offset, turn_speed);
         read_from_blob(blob, offset, type);
+        if (type >= TOWER_TYPE_MAX) reject_blob(offset, "unknown tower type");
+        read_from_blob(blob, offset, modifiers);
         read_from_blob(blob, offset, position);
         read_from_blob(blob, offset, size);
         read_from_blob(blob, offset, direction);
         read_from_blob(blob, offset, target_id);
-        read_from_blob(blob, offset, target_lock);
+        bool flag;
+        read_from_blob(blob, offset, flag);
+        target_lock = flag;
     }
 
 };
@@ -412,12 +593,13 @@ struct EnemySpawner {
     Enemy_Type type = CHICKEN;
     Vector2 position = {0.f, 0.f};
     float delay = 1.f;
-    float time_since_spawn = 0.f;
+    // level time the next enemy is due at
+    float next_spawn = 0.f;
     u64 max = 0;
     u64 spawned = 0;
 
+    // spawns every enemy due at level.time
     void spawn(Level& level);
-    void update(Level& level);
 
     size_t get_byte_size() const {
         size_t size = 0;
@@ -425,7 +607,7 @@ struct EnemySpawner {
         size += sizeof(type);
         size += sizeof(position);
         size += sizeof(delay);
-        size += sizeof(time_since_spawn);
+        size += sizeof(next_spawn);
         size += sizeof(max);
         size += sizeof(spawned);
         return size;
@@ -438,7 +620,7 @@ struct EnemySpawner {
         write_to_blob(blob, offset, type);
         write_to_blob(blob, offset, position);
         write_to_blob(blob, offset, delay);
-        write_to_blob(blob, offset, time_since_spawn);
+        write_to_blob(blob, offset, next_spawn);
         write_to_blob(blob, offset, max);
         write_to_blob(blob, offset, spawned);
 
@@ -449,14 +631,45 @@ struct EnemySpawner {
     void load_from_blob(byte* blob, size_t& offset) {
         read_from_blob(blob, offset, active);
         read_from_blob(blob, offset, type);
+        if (type >= ENEMY_TYPE_MAX) reject_blob(offset, "unknown spawner enemy type");
         read_from_blob(blob, offset, position);
         read_from_blob(blob, offset, delay);
-        read_from_blob(blob, offset, time_since_spawn);
+        read_from_blob(blob, offset, next_spawn);
         read_from_blob(blob, offset, max);
         read_from_blob(blob, offset, spawned);
     }
 };
 
+// min heap of spawners keyed by the time of their next spawn, a tick only
+// touches the spawners that are due. Finished spawners are dropped.
+struct SpawnScheduler {
+    std::vector<EnemySpawner> spawners;
+
+    void schedule(const EnemySpawner& spawner);
+
+    // takes out the first spawner placed like this one, O(log n) past the
+    // search. false if there is none
+    bool remove(const EnemySpawner& spawner);
+
+    void update(Level& level);
+
+    size_t size() const { return spawners.size(); }
+
+    size_t get_byte_size() const {
+        size_t size = sizeof(size_t);
+        for (const EnemySpawner& es : spawners) size += es.get_byte_size();
+        return size;
+    }
+
+    void save_to_blob(byte* blob, size_t& offset) const {
+        struct_array_to_blob(blob, offset, spawners);
+    }
+
+    void load_from_blob(byte* blob, size_t& offset) {
+        struct_array_from_blob(blob, offset, spawners);
+    }
+};
+
 struct SpawnEvent {
     float start;   
     float delay;
@@ -464,7 +677,7 @@ struct SpawnEvent {
     Vector2 position;
 
 
-    void spawn(std::vector<Enemy>& enemies, std::vector<EnemySpawner>& spawners);
+    void spawn(Level& level);
 
     size_t get_byte_size() const {
         size_t size = 0;
@@ -502,13 +715,15 @@ struct Round {
     float time = 0.f;
     u64 next_event = 0;
 
-    void update(std::vector<Enemy>& enemies, std::vector<EnemySpawner>& spawners);
+    void update(Level& level, float dt);
+
+    bool done() const { return next_event >= events.size(); }
 
     size_t get_byte_size() const {
         size_t size = 0;
 
         size += sizeof(size_t);
-        for (const SpawnEvent e : events) {
+        for (const SpawnEvent& e : events) {
             size += e.get_byte_size(); 
         }
         size += sizeof(length);
@@ -537,48 +752,227 @@ struct Round {
     }
 };
 
-struct Level {
-    Map map;
+struct DamageQueue {
+    static constexpr u32 NO_TOWER = UINT32_MAX;
+
+    // one buffer per parallel_for chunk, filled without locking
+    std::vector<std::vector<DamageEvent>> buffers;
+    // events queued from the main thread, also where the buffers get merged
+    std::vector<DamageEvent> events;
+    // apply scratch, enemy index in the high half and queue position in the low
+    std::vector<u64> order;
+
+    // empties the buffers and makes sure there are at least count of them
+    void reset(size_t count);
+
+    void push(DamageEvent event) { events.push_back(event); }
+
+    // sorted by enemy so the writes walk the enemy array once, ties keep
+    // queue order. Returns the number of kills.
+    u64 apply(std::vector<Enemy>& enemies, std::vector<u64>& tower_kills);
+};
+
+// lead targeting for the straight shooting towers that fire this tick. Flat
+// arrays so the intercept solve is a single branch free pass over all of them.
+struct AimBatch {
+    std::vector<u32> tower;
+    // target center relative to the muzzle, the aim point after solve
+    std::vector<float> dx, dy;
+    std::vector<float> vx, vy;
+
+    void clear();
+
+    size_t size() const { return tower.size(); }
+
+    void add(u32 tower_index, Vector2 muzzle, const EnemyRecord& target);
+
+    // replaces dx, dy with where the target will be when a projectile of
+    // projectile_speed gets there, the current position if it can't catch up
+    void solve(float projectile_speed);
+};
+
+struct LevelStats {
+    // enemies that made it through the last waypoint
+    u64 leaked = 0;
+    u64 killed = 0;
+    // level time when the last round was cleared, -1 while running
+    float clear_time = -1.f;
+    u64 shots = 0;
+    u64 hits = 0;
+    // per tower, same order as Level::towers
+    std::vector<u64> tower_kills;
+    u64 ticks = 0;
+    // live bullets summed over ticks, / ticks gives the average
+    u64 bullet_ticks = 0;
+
+    float hit_rate() const { return shots ? (float)hits / shots : 0.f; }
+
+    float average_bullets() const { return ticks ? (float)bullet_ticks / ticks : 0.f; }
+};
+
+// parts of a Level the autosave serializes on their own, see autosave.hpp
+enum Save_Section : uint8_t {
+    SECTION_MAP,
+    SECTION_TOWERS,
+    SECTION_SPAWNERS,
+    SECTION_ROUNDS,
+    // enemies, records and bullets
+    SECTION_ENTITIES,
+    SAVE_SECTION_MAX
+};
+
+constexpr uint8_t section_bit(Save_Section section) { return (uint8_t)(1u << section); }
+
+constexpr uint8_t ALL_SECTIONS = (uint8_t)((1u << SAVE_SECTION_MAX) - 1);
+
+// first bytes of a level file, bump the version when the layout changes
+static constexpr u32 LEVEL_FILE_MAGIC = 0x4c56454c; // "LEVL"
+static constexpr u32 LEVEL_FILE_VERSION = 1;
+static constexpr size_t LEVEL_FILE_HEADER_SIZE = sizeof(LEVEL_FILE_MAGIC) + sizeof(LEVEL_FILE_VERSION);
+
+// cache line aligned so levels updated on different threads never share a line
+struct alignas(64) Level {
+    // shared between forks of a level, write through edit_map
+    std::shared_ptr<Map> map;
 
     std::vector<Enemy> enemies;
     std::vector<EnemyRecord> enemy_records;
     std::vector<Tower> towers;
-    std::vector<EnemySpawner> spawners;
+    SpawnScheduler scheduler;
     std::vector<Projectile> bullets;
     std::vector<Round> rounds;
 
     std::string name; 
     float time = 0.f;
     int active_round = -1;
-    u64 object_id_counter = 0;
+    u32 object_id_counter = 0;
+    LevelStats stats;
+
+    // tower changes not applied to the flow field yet and the job applying the last batch
+    std::vector<FlowChange> flow_changes;
+    std::future<std::shared_ptr<const FlowField>> flow_job;
+
+    // areas of towers placed in this level alone, see add_local_tower. Kept
+    // out of the map so forks placing their own towers keep sharing it
+    std::vector<Rectangle> local_areas;
+    // once there are local areas the level's flow field lives here, the
+    // map's one with local_areas blocked too
+    std::shared_ptr<const FlowField> local_flow_field;
+
+    // enemies by path segment, derived from enemies and waypoints, not saved
+    PathProgress path;
+
+    // Save_Section bits changed since the autosave last took them. The Level
+    // methods mark what they touch, code writing the arrays directly calls
+    // mark_dirty itself
+    uint8_t dirty_sections = ALL_SECTIONS;
+
+    // scratch for update_towers and update_bullets, not saved
+    AimBatch aim;
+    DamageQueue damage;
+    SpatialGrid enemy_grid;
+    std::vector<Vector2> grid_points;
+
+    // empty level for loading, nothing reserved
+    Level();
 
     Level(const char* name, Rectangle bounds);
 
+    Level(const Level&) = delete;
+    Level& operator=(const Level&) = delete;
+    Level(Level&&) = default;
+    Level& operator=(Level&&) = default;
+
+    // nullopt if the file doesn't load, load_from_file logged why
+    static std::optional<Level> from_file(const char* file_name);
+
+    // copy of everything but the map, which is shared until one side edits it
+    Level fork() const;
+
+    // takes map, rounds and towers from a freshly loaded copy of this level's
+    // file while it keeps running. Live enemies and spawners stay, bullets
+    // are dropped with the towers that fired them. An unchanged map is kept
+    // with its flow field
+    void hot_swap(Level&& loaded);
+
+    // unshares the map first if another level still uses it
+    Map& edit_map();
+
+    void mark_dirty(uint8_t sections) { dirty_sections |= sections; }
+
+    Rectangle get_bounds() const;
+
+    bool is_cleared() const;
+
     void start();
 
-    void update(Rectangle game_boundary);
+    void update(Rectangle game_boundary, float dt);
 
-    void update_enemies();
+    void update_enemies(float dt);
 
-    void update_bullets(Rectangle game_boundary);
+    // recounts path from scratch, after loading or when the waypoints changed
+    void rebuild_path_progress();
+
+    void update_bullets(Rectangle game_boundary, float dt);
 
     void update_spawners();
 
-    void update_towers();
+    void update_towers(float dt);
+
+    // indexes the enemies by center, valid until update_enemies moves or removes them
+    void build_enemy_grid();
+
+    // queues damage for every live enemy with its center within radius, skip
+    // is an enemy index to leave out
+    void add_area_damage(Vector2 center, float radius, float amount, u32 tower, u32 skip, std::vector<DamageEvent>& events) const;
 
-    void update_round();
+    void update_round(float dt);
+
+    // publishes a finished flow field job and starts one for pending changes.
+    // wait = true finishes everything on the calling thread
+    void update_flow_field(bool wait = false);
 
     void spawn_bullet(Tower& tower);
 
     void add_tower(Tower tower);
 
+    // like add_tower, but the area goes to local_areas and the shared map
+    // stays untouched. For throwaway forks like batch runs: the area isn't
+    // saved, a saved and loaded level has the tower without it
+    void add_local_tower(Tower tower);
+
+    // free in the map and in local_areas
+    bool check_free(Rectangle rec) const;
+
+    // the flow field enemies follow, null when there is none
+    const FlowField* get_flow_field() const {
+        return local_flow_field ? local_flow_field.get() : map->flow_field.get();
+    }
+
+    // the last tower moves into index, its bullets follow it. Bullets of the
+    // removed tower are dropped and its area is freed in the map and the
+    // flow field
+    void remove_tower(u32 index);
+
+    // exact inverse of remove_tower(index)
+    void insert_tower(u32 index, Tower tower, u64 kills);
+
     void add_enemy(Enemy& enemy);
 
-    std::string to_string(const char* prefix = "");
+    // count copies of prototype with consecutive ids, grows each array at most once
+    void add_enemies(const Enemy& prototype, u64 count);
+
+    // what in the loaded arrays points past the array it indexes, null if
+    // nothing does
+    const char* find_bad_index() const;
 
+    // debug text, pass frame_arena() for text that only lives this frame
+    std::pmr::string to_string(const char* prefix = "", std::pmr::memory_resource* memory = std::pmr::get_default_resource()) const;
+
+    // of the file, header included
     size_t get_byte_size() const {
-        size_t size = 0;
-        size += map.get_byte_size();
+        size_t size = LEVEL_FILE_HEADER_SIZE;
+        size += map->get_byte_size();
 
         size += sizeof(size_t);
         for (const Enemy& e : enemies) size += e.get_byte_size();
@@ -589,8 +983,7 @@ struct Level {
         size += sizeof(size_t);
         for (const Tower& t : towers) size += t.get_byte_size();
 
-        size += sizeof(size_t);
-        for (const EnemySpawner& es : spawners) size += es.get_byte_size();
+        size += scheduler.get_byte_size();
 
         size += sizeof(size_t);
         for (const Projectile& p : bullets) size += p.get_byte_size();
@@ -608,17 +1001,20 @@ struct Level {
         return size;
     }
 
+    // Autosave writes the same layout piece by piece, keep them in step
     void save_to_file(const char* file_name) const {
         size_t total_size = get_byte_size();
         byte* blob = new byte[total_size];
         size_t offset = 0;
 
-        map.save_to_blob(blob, offset);
+        write_to_blob(blob, offset, LEVEL_FILE_MAGIC);
+        write_to_blob(blob, offset, LEVEL_FILE_VERSION);
+        map->save_to_blob(blob, offset);
 
         struct_array_to_blob(blob, offset, enemies);
         struct_array_to_blob(blob, offset, enemy_records);
         struct_array_to_blob(blob, offset, towers);
-        struct_array_to_blob(blob, offset, spawners);
+        scheduler.save_to_blob(blob, offset);
         struct_array_to_blob(blob, offset, bullets);
         struct_array_to_blob(blob, offset, rounds);
 
@@ -634,36 +1030,168 @@ struct Level {
         delete[] blob;
     }
 
-    void load_from_file(const char* file_name) {
+    // false if the file is missing, of another version, its size doesn't
+    // match what was parsed or a type or index in it is out of range. The
+    // level is half loaded then
+    bool load_from_file(const char* file_name) {
         int total_size = 0;
         byte* blob = (byte*)LoadFileData(file_name, &total_size);
+        if (!blob) {
+            log_low(LOG_IO, "could not read {}", file_name);
+            return false;
+        }
         size_t offset = 0;
-        map.load_from_blob(blob, offset);
+        blob_read_end = (size_t)total_size;
+        blob_read_error = nullptr;
+        u32 magic = 0, version = 0;
+        read_from_blob(blob, offset, magic);
+        read_from_blob(blob, offset, version);
+        if (magic != LEVEL_FILE_MAGIC || version != LEVEL_FILE_VERSION) {
+            UnloadFileData(blob);
+            blob_read_end = SIZE_MAX;
+            log_low(LOG_IO, "{} is no level file of version {}", file_name, LEVEL_FILE_VERSION);
+            return false;
+        }
+        edit_map().load_from_blob(blob, offset);
 
         struct_array_from_blob(blob, offset, enemies);
         struct_array_from_blob(blob, offset, enemy_records);
         struct_array_from_blob(blob, offset, towers);
-        struct_array_from_blob(blob, offset, spawners);
+        scheduler.load_from_blob(blob, offset);
         struct_array_from_blob(blob, offset, bullets);
         struct_array_from_blob(blob, offset, rounds);
 
         string_from_blob(blob, offset, name);
         read_from_blob(blob, offset, time);
-        write_to_blob(blob, offset, active_round);
+        read_from_blob(blob, offset, active_round);
         read_from_blob(blob, offset, object_id_counter);
 
         UnloadFileData(blob);
+        blob_read_end = SIZE_MAX;
+        if (blob_read_error) {
+            log_low(LOG_IO, "{}: {}", file_name, blob_read_error);
+            blob_read_error = nullptr;
+            return false;
+        }
+        if (offset == BLOB_OVERRUN) {
+            log_low(LOG_IO, "{} is truncated, {} bytes", file_name, total_size);
+            return false;
+        }
+        if (offset != (size_t)total_size) {
+            log_low(LOG_IO, "{} is {} bytes, parsed {}", file_name, total_size, offset);
+            return false;
+        }
+        if (const char* error = find_bad_index()) {
+            log_low(LOG_IO, "{}: {}", file_name, error);
+            return false;
+        }
+
+        if (map->use_flow_field) edit_map().build_flow_field();
+        rebuild_path_progress();
+        mark_dirty(ALL_SECTIONS);
+        return true;
     }
 
 };
 
+enum Edit_Type : uint8_t {
+    EDIT_ADD_TOWER,
+    EDIT_REMOVE_TOWER,
+    EDIT_ADD_SPAWNER,
+    EDIT_REMOVE_SPAWNER,
+};
+
+// one editor change with just enough to run it either way. Undo applies the
+// inverse, so a step costs the size of this and never a copy of the level
+struct EditOp {
+    Edit_Type type;
+    // where the tower was for EDIT_REMOVE_TOWER
+    u32 index = 0;
+    u64 kills = 0;
+    union {
+        Tower tower;
+        EnemySpawner spawner;
+    };
+
+    EditOp(Edit_Type type, const Tower& tower, u32 index = 0, u64 kills = 0) : type(type), index(index), kills(kills), tower(tower) {}
+
+    EditOp(Edit_Type type, const EnemySpawner& spawner) : type(type), spawner(spawner) {}
+};
+
+static_assert(std::is_trivially_copyable_v<EditOp>);
+
+// every change to a level goes through here to be undoable. ops[0, applied)
+// are in effect, the rest can be redone until the next new change
 struct LevelEditor {
+    std::vector<EditOp> ops;
+    size_t applied = 0;
+
     void place_tower(const Tower& tower, Level& level) {
-        level.add_tower(tower);
-    }    
+        record(EditOp(EDIT_ADD_TOWER, tower), level);
+    }
+
+    void remove_tower(u32 index, Level& level) {
+        if (index >= level.towers.size()) return;
+        record(EditOp(EDIT_REMOVE_TOWER, level.towers[index], index, level.stats.tower_kills[index]), level);
+    }
 
     void place_spawner(const EnemySpawner& spawner, Level& level) {
-        level.spawners.push_back(spawner);
+        record(EditOp(EDIT_ADD_SPAWNER, spawner), level);
+    }
+
+    void remove_spawner(const EnemySpawner& spawner, Level& level) {
+        record(EditOp(EDIT_REMOVE_SPAWNER, spawner), level);
+    }
+
+    // false when there is nothing to undo
+    bool undo(Level& level) {
+        if (applied == 0) return false;
+        apply(ops[--applied], level, false);
+        return true;
+    }
+
+    bool redo(Level& level) {
+        if (applied == ops.size()) return false;
+        apply(ops[applied++], level, true);
+        return true;
+    }
+
+    // the level was replaced, the steps don't fit it anymore
+    void clear() {
+        ops.clear();
+        applied = 0;
+    }
+
+    size_t get_byte_size() const { return ops.size() * sizeof(EditOp); }
+
+    void record(const EditOp& op, Level& level) {
+        ops.erase(ops.begin() + applied, ops.end());
+        ops.push_back(op);
+        redo(level);
+    }
+
+    static void apply(const EditOp& op, Level& level, bool forward) {
+        switch (op.type) {
+        case EDIT_ADD_TOWER:
+            // undone in order, so the tower is still the last one
+            if (forward) level.add_tower(op.tower);
+            else level.remove_tower((u32)level.towers.size() - 1);
+            break;
+        case EDIT_REMOVE_TOWER:
+            if (forward) level.remove_tower(op.index);
+            else level.insert_tower(op.index, op.tower, op.kills);
+            break;
+        case EDIT_ADD_SPAWNER:
+            level.mark_dirty(section_bit(SECTION_SPAWNERS));
+            if (forward) level.scheduler.schedule(op.spawner);
+            else level.scheduler.remove(op.spawner);
+            break;
+        case EDIT_REMOVE_SPAWNER:
+            level.mark_dirty(section_bit(SECTION_SPAWNERS));
+            if (forward) level.scheduler.remove(op.spawner);
+            else level.scheduler.schedule(op.spawner);
+            break;
+        }
     }
 };
 
@@ -673,13 +1201,40 @@ struct Game {
     Tower* selected_building = nullptr;
     bool paused = true;
     bool edit_mode = false;
-    Level edit_level;
     Rectangle boundary;
+    Level edit_level;
     bool quit = false;
+    // undo history of the level being played or edited
+    LevelEditor editor;
+
+    // attract mode, every level runs at once
+    bool simulate_all = false;
+    u64 sim_ticks = 0;
+    double sim_seconds = 0.0;
+    float ticks_per_second = 0.f;
+
+    // allocation panel, only there with ALLOC_TRACKING
+    bool show_alloc_panel = false;
+
+    // view into the level being played or edited, GameController pans and
+    // zooms it. Identity until moved, world and screen pixels line up
+    Camera2D camera = {.offset = {0.f, 0.f}, .target = {0.f, 0.f}, .rotation = 0.f, .zoom = 1.f};
 
     Game();
 
-    Game(Rectangle boundary, const std::vector<Level>& levels);
+    Game(Rectangle boundary, std::vector<Level>&& levels);
+
+    Game(const Game&) = delete;
+    Game& operator=(const Game&) = delete;
+    Game(Game&&) = default;
+    Game& operator=(Game&&) = default;
+
+    // file each level was loaded from, empty for levels made in code. Shorter
+    // than levels when the last ones weren't loaded
+    std::vector<std::string> level_files;
+
+    // one Level per file, loaded in place
+    void load_levels(const std::vector<std::string>& file_names);
 
     void start();
 
@@ -687,41 +1242,134 @@ struct Game {
 
     void update();
 
+    // steps every level on the job pool, one task per level
+    void update_all(float dt);
+
+    void toggle_simulate_all();
+
     void start_edit() {
         edit_level = Level("New Level", boundary);
         edit_mode = true;
+        editor.clear();
     }
 
     void stop_edit() {
         edit_mode = false;
         paused = true;
+        editor.clear();
     }
 
     Level& get_current_level();
 
     std::string to_string();
+
+    std::string memory_report() const;
 };
 
+static_assert(!std::is_copy_constructible_v<Level> && std::is_nothrow_move_constructible_v<Level>);
+static_assert(!std::is_copy_constructible_v<Map> && std::is_nothrow_move_constructible_v<Map>);
+static_assert(!std::is_copy_constructible_v<Game>);
+
+// the per tick loops stream these arrays, growing one should be a decision
+static_assert(sizeof(Enemy) == 44);
+static_assert(sizeof(EnemyRecord) == 20);
+static_assert(sizeof(Projectile) == 32);
+static_assert(sizeof(Tower) == 52);
+static_assert(sizeof(DamageEvent) == 12);
+
 struct GameController {
+    // world pixels per second at zoom 1
+    static constexpr float PAN_SPEED = 800.f;
+    static constexpr float MAX_ZOOM = 4.f;
+
+    // wheel zooms around the cursor, arrows/wasd or right drag pan. The view
+    // stays on the map, zoomed out no further than the whole map
+    static void update_camera(Camera2D& camera, const Level& level) {
+        Rectangle bounds = level.get_bounds();
+        if (bounds.width <= 0.f || bounds.height <= 0.f) return;
+        float screen_width = (float)GetScreenWidth();
+        float screen_height = (float)GetScreenHeight();
+        float min_zoom = std::min(1.f, std::min(screen_width / bounds.width, screen_height / bounds.height));
+
+        float wheel = GetMouseWheelMove();
+        if (wheel != 0.f) {
+            Vector2 mouse = GetMousePosition();
+            Vector2 anchor = GetScreenToWorld2D(mouse, camera);
+            camera.zoom = Clamp(camera.zoom * powf(1.15f, wheel), min_zoom, MAX_ZOOM);
+            camera.offset = mouse;
+            camera.target = anchor;
+        }
+        if (IsMouseButtonDown(MOUSE_BUTTON_RIGHT)) {
+            camera.target = Vector2Subtract(camera.target, Vector2Scale(GetMouseDelta(), 1.f / camera.zoom));
+        }
+        Vector2 direction = {0.f, 0.f};
+        if (IsKeyDown(KEY_LEFT) || IsKeyDown(KEY_A)) direction.x -= 1.f;
+        if (IsKeyDown(KEY_RIGHT) || IsKeyDown(KEY_D)) direction.x += 1.f;
+        if (IsKeyDown(KEY_UP) || IsKeyDown(KEY_W)) direction.y -= 1.f;
+        if (IsKeyDown(KEY_DOWN) || IsKeyDown(KEY_S)) direction.y += 1.f;
+        camera.target = Vector2Add(camera.target, Vector2Scale(direction, PAN_SPEED * GetFrameTime() / camera.zoom));
+
+        // clamp the top left corner of the view, centered when the map is smaller
+        float view_width = screen_width / camera.zoom;
+        float view_height = screen_height / camera.zoom;
+        Vector2 corner = Vector2Subtract(camera.target, Vector2Scale(camera.offset, 1.f / camera.zoom));
+        corner.x = view_width >= bounds.width ? (bounds.width - view_width) / 2.f : Clamp(corner.x, 0.f, bounds.width - view_width);
+        corner.y = view_height >= bounds.height ? (bounds.height - view_height) / 2.f : Clamp(corner.y, 0.f, bounds.height - view_height);
+        camera.target = Vector2Add(corner, Vector2Scale(camera.offset, 1.f / camera.zoom));
+    }
 
     static void update(Game& game) {
+#if ALLOC_TRACKING
+        if (IsKeyPressed(KEY_F3)) {
+            game.show_alloc_panel = !game.show_alloc_panel;
+        }
+        if (IsKeyPressed(KEY_F4)) {
+            if (alloc_tracker().write_csv("alloc_frames.csv")) log_var("alloc_frames.csv", "allocations written to");
+        }
+#endif
+        if (IsKeyPressed(KEY_T)) {
+            game.toggle_simulate_all();
+        }
+        if (game.simulate_all) return;
         if (game.active_level == -1) return;
         if (IsKeyPressed(KEY_SPACE)) {
             game.paused = !game.paused;
         }
-        Vector2 position = {(float)GetMouseX(), (float)GetMouseY()};
+        if (IsKeyPressed(KEY_M)) {
+            log_var(game.memory_report());
+        }
+        Level* level = nullptr;
+        if (game.edit_mode) level = &game.edit_level;
+
+        else level = &game.get_current_level();
+        update_camera(game.camera, *level);
+
+        Vector2 position = GetScreenToWorld2D(GetMousePosition(), game.camera);
         Tower tower;
         tower.position = position;
         Rectangle rec = {to_rec(tower.position, tower.size)};
 
-        Level* level = nullptr;
-        if (game.edit_mode) level = &game.edit_level;
+        // ctrl+z undo, ctrl+y or ctrl+shift+z redo, delete removes the tower under the cursor
+        bool control = IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL);
+        bool shift = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
+        if (control && IsKeyPressed(KEY_Z)) {
+            if (shift) game.editor.redo(*level);
+            else game.editor.undo(*level);
+        }
+        if (control && IsKeyPressed(KEY_Y)) game.editor.redo(*level);
+        if (IsKeyPressed(KEY_DELETE)) {
+            for (u32 i = 0; i < level->towers.size(); ++i) {
+                const Tower& placed = level->towers[i];
+                if (!CheckCollisionPointRec(position, to_rec(placed.position, placed.size))) continue;
+                game.editor.remove_tower(i, *level);
+                break;
+            }
+        }
 
-        else level = &game.get_current_level();
-        if (level->map.check_free(rec)) {
+        if (level->check_free(rec)) {
             DrawRectangleRec(rec, GREEN);
             if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
-                level->add_tower(tower);
+                game.editor.place_tower(tower, *level);
             }
                 
         } else {
@@ -748,23 +1396,93 @@ static Vector2 get_rec_center(Rectangle rec) {
 static Rectangle to_rec(const Vector2& v1, const Vector2& v2) {
     return {v1.x, v1.y, v2.x, v2.y};
 }
+
+// segment against an axis aligned box (slab test), t in [0, 1]
+static bool sweep_point_rec(Vector2 start, Vector2 delta, Rectangle rec, float& t) {
+    float t_min = 0.f;
+    float t_max = 1.f;
+    float p[2] = {start.x, start.y};
+    float d[2] = {delta.x, delta.y};
+    float lo[2] = {rec.x, rec.y};
+    float hi[2] = {rec.x + rec.width, rec.y + rec.height};
+    for (int axis = 0; axis < 2; ++axis) {
+        if (fabsf(d[axis]) < 1e-8f) {
+            if (p[axis] < lo[axis] || p[axis] > hi[axis]) return false;
+            continue;
+        }
+        float inv = 1.f / d[axis];
+        float t0 = (lo[axis] - p[axis]) * inv;
+        float t1 = (hi[axis] - p[axis]) * inv;
+        if (t0 > t1) std::swap(t0, t1);
+        t_min = std::max(t_min, t0);
+        t_max = std::min(t_max, t1);
+        if (t_min > t_max) return false;
+    }
+    t = t_min;
+    return true;
+}
+
+// segment against a circle, t in [0, 1]
+static bool sweep_point_circle(Vector2 start, Vector2 delta, Vector2 center, float radius, float& t) {
+    Vector2 m = Vector2Subtract(start, center);
+    float c = Vector2DotProduct(m, m) - radius * radius;
+    if (c <= 0.f) {
+        t = 0.f;
+        return true;
+    }
+    float a = Vector2DotProduct(delta, delta);
+    float b = Vector2DotProduct(m, delta);
+    if (b >= 0.f || a < 1e-12f) return false;
+    float discriminant = b * b - a * c;
+    if (discriminant < 0.f) return false;
+    t = (-b - sqrtf(discriminant)) / a;
+    return t <= 1.f;
+}
+
+// the rectangle grown by radius is two crossed rectangles plus four corner circles
+static bool sweep_circle_rec(Vector2 start, Vector2 delta, float radius, Rectangle rec, float& toi) {
+    float best = INFINITY;
+    float t;
+    Rectangle wide = {rec.x - radius, rec.y, rec.width + 2.f * radius, rec.height};
+    Rectangle tall = {rec.x, rec.y - radius, rec.width, rec.height + 2.f * radius};
+    if (sweep_point_rec(start, delta, wide, t)) best = std::min(best, t);
+    if (sweep_point_rec(start, delta, tall, t)) best = std::min(best, t);
+    Vector2 corners[4] = {
+        {rec.x, rec.y}, {rec.x + rec.width, rec.y},
+        {rec.x, rec.y + rec.height}, {rec.x + rec.width, rec.y + rec.height},
+    };
+    for (Vector2 corner : corners) {
+        if (best == 0.f) break;
+        if (sweep_point_circle(start, delta, corner, radius, t)) best = std::min(best, t);
+    }
+    if (best > 1.f) return false;
+    toi = best;
+    return true;
+}
 // edit level gets reinitialized later
 Game::Game(): boundary({0, 0, 1200, 900}), edit_level(Level("New Level", boundary)) {
     levels.reserve(10);
 }
 
-Game::Game(Rectangle boundary, const std::vector<Level>& levels)
-    : edit_level(Level("New Level", boundary)) {
+Game::Game(Rectangle boundary, std::vector<Level>&& levels)
+    : levels(std::move(levels)), boundary(boundary), edit_level(Level("New Level", boundary)) {
+}
 
-    this->levels.reserve(levels.size());
-    for (int i = 0; i < levels.size(); ++i) {
-        this->levels.push_back(levels[i]);
+void Game::load_levels(const std::vector<std::string>& file_names) {
+    levels.reserve(levels.size() + file_names.size());
+    level_files.resize(levels.size());
+    for (const std::string& file_name : file_names) {
+        std::optional<Level> level = Level::from_file(file_name.c_str());
+        // a broken file is left out of the campaign instead of played empty
+        if (!level) continue;
+        levels.push_back(std::move(*level));
+        level_files.push_back(file_name);
     }
 }
 
 void Game::start() {
     if (levels.size() == 0) {
-        std::cerr << "No levels found!\n";
+        log_low(LOG_GAME, "no levels found");
         return;
     }
     // already active
@@ -780,6 +1498,7 @@ void Game::start() {
 
 void Game::select_level(u64 index) {
     assert(index < levels.size());
+    if ((int)index != active_level) editor.clear();
     active_level = index;
 }
 
@@ -787,8 +1506,38 @@ void Game::update() {
     if (edit_mode) {
         return;
     }
+    if (simulate_all) {
+        update_all(GetFrameTime());
+        return;
+    }
     assert(active_level < (int)levels.size());
-    levels[active_level].update(boundary);
+    levels[active_level].update(boundary, GetFrameTime());
+}
+
+void Game::update_all(float dt) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    job_pool().parallel_for(levels.size(), [this, dt](u64 i) {
+        levels[i].update(boundary, dt);
+    });
+    sim_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    sim_ticks += levels.size();
+
+    // level ticks per second spent simulating, averaged over ~1s of it
+    if (sim_seconds >= 1.0 || sim_ticks >= 1000000) {
+        ticks_per_second = sim_seconds > 0.0 ? (float)(sim_ticks / sim_seconds) : 0.f;
+        sim_ticks = 0;
+        sim_seconds = 0.0;
+    }
+}
+
+void Game::toggle_simulate_all() {
+    simulate_all = !simulate_all;
+    if (!simulate_all) return;
+    for (Level& level : levels) {
+        if (level.active_round < 0) level.start();
+    }
+    sim_ticks = 0;
+    sim_seconds = 0.0;
 }
 
 Level& Game::get_current_level() {
@@ -806,77 +1555,505 @@ std::string Game::to_string() {
     return out;
 
 }
-Level::Level(const char* name, Rectangle bounds):name(name), map(bounds) {
+std::string Game::memory_report() const {
+    // every level draws from the one tile cache
+    const GroundTiles& tiles = ground_tiles();
+    std::string out = "Texture memory: \n";
+    out += "ground tiles: "; out += std::to_string(tiles.size()); out += " of "; out += std::to_string(tiles.budget);
+    out += ", "; out += std::to_string(tiles.get_pending()); out += " pending\n";
+    out += "total: "; out += std::to_string(tiles.get_texture_bytes()); out += " bytes\n";
+    return out;
+}
+
+Level::Level(): map(std::make_shared<Map>()) {
+}
+
+Level::Level(const char* name, Rectangle bounds):map(std::make_shared<Map>(bounds)), name(name) {
     enemies.reserve(100); 
     towers.reserve(100); 
 }
 
+Level Level::fork() const {
+    Level level;
+    level.map = map;
+    level.enemies = enemies;
+    level.enemy_records = enemy_records;
+    level.towers = towers;
+    level.scheduler = scheduler;
+    level.bullets = bullets;
+    level.rounds = rounds;
+    level.name = name;
+    level.time = time;
+    level.active_round = active_round;
+    level.object_id_counter = object_id_counter;
+    level.stats = stats;
+    level.flow_changes = flow_changes;
+    level.local_areas = local_areas;
+    level.local_flow_field = local_flow_field;
+    level.path = path;
+    return level;
+}
+
+Map& Level::edit_map() {
+    mark_dirty(section_bit(SECTION_MAP));
+    if (map.use_count() > 1) {
+        map = std::make_shared<Map>(map->clone());
+    }
+    return *map;
+}
+
+Rectangle Level::get_bounds() const {
+    return {0.f, 0.f, (float)map->width, (float)map->height};
+}
+
+bool Level::is_cleared() const {
+    if (active_round < 0) return false;
+    for (int i = active_round; i < (int)rounds.size(); ++i) {
+        if (!rounds[i].done()) return false;
+    }
+    return scheduler.size() == 0 && enemies.empty();
+}
+
+std::optional<Level> Level::from_file(const char* file_name) {
+    Level level;
+    if (!level.load_from_file(file_name)) return std::nullopt;
+    return level;
+}
+
+const char* Level::find_bad_index() const {
+    u64 record_count = enemy_records.size();
+    if (record_count > object_id_counter) return "more enemy records than ids handed out";
+    for (const Enemy& enemy : enemies) {
+        if (enemy.id >= record_count) return "enemy id without a record";
+        // dead ones keep whatever they had, update never reads it
+        if (enemy.active && enemy.next_waypoint >= map->waypoints.size()) return "enemy heading for a waypoint the map doesn't have";
+    }
+    for (const Tower& tower : towers) {
+        if (tower.target_lock && tower.target_id >= record_count) return "tower target without a record";
+    }
+    for (const Projectile& bullet : bullets) {
+        if (!bullet.active) continue;
+        if (bullet.tower_index >= towers.size()) return "bullet of a tower that doesn't exist";
+        if (bullet.type == SEEK && bullet.target_id >= record_count) return "bullet target without a record";
+    }
+    if (active_round >= (int)rounds.size()) return "active round past the last round";
+    for (const Round& round : rounds) {
+        if (round.next_event > round.events.size()) return "round past its last event";
+    }
+    return nullptr;
+}
+
 void Level::start() {
     time = 0.f;
     // TODO::choose
-    active_round = 0;
+    active_round = rounds.empty() ? -1 : 0;
+    stats = LevelStats();
+    stats.tower_kills.assign(towers.size(), 0);
+    log_full(LOG_LEVEL, "{} started, {} rounds, {} towers", name, rounds.size(), towers.size());
 }
 
-void Level::update(Rectangle game_boundary) {
-    time += GetFrameTime();
-    update_round();
-    update_spawners();
-    update_towers();
-    update_bullets(game_boundary);
-    update_enemies();
+void Level::update(Rectangle game_boundary, float dt) {
+    // a tick moves everything but the map, towers keep their aim and cooldown
+    mark_dirty(ALL_SECTIONS & ~section_bit(SECTION_MAP));
+    {
+        AllocPhaseScope phase(PHASE_FLOW_FIELD);
+        update_flow_field();
+    }
+    time += dt;
+    {
+        AllocPhaseScope phase(PHASE_SPAWN);
+        update_round(dt);
+        update_spawners();
+    }
+    {
+        AllocPhaseScope phase(PHASE_TOWERS);
+        update_towers(dt);
+    }
+    {
+        AllocPhaseScope phase(PHASE_BULLETS);
+        update_bullets(game_boundary, dt);
+    }
+    {
+        AllocPhaseScope phase(PHASE_ENEMIES);
+        update_enemies(dt);
+    }
+
+    if (stats.clear_time < 0.f && is_cleared()) {
+        stats.clear_time = time;
+        log_low(LOG_LEVEL, "{} cleared at t = {}, {} killed, {} leaked", name, time, stats.killed, stats.leaked);
+    }
+#if ALLOC_TRACKING
+    // capacity only grows within a tick, so the end of it is the peak
+    AllocTracker& tracker = alloc_tracker();
+    tracker.note_container(CONTAINER_ENEMIES, enemies.capacity() * sizeof(Enemy));
+    tracker.note_container(CONTAINER_ENEMY_RECORDS, enemy_records.capacity() * sizeof(EnemyRecord));
+    tracker.note_container(CONTAINER_BULLETS, bullets.capacity() * sizeof(Projectile));
+    tracker.note_container(CONTAINER_SPAWNERS, scheduler.spawners.capacity() * sizeof(EnemySpawner));
+#endif
 }
 
 void Level::add_enemy(Enemy& enemy) {
+    mark_dirty(section_bit(SECTION_ENTITIES));
     enemy.id = object_id_counter++;
     enemies.push_back(enemy);
+    if (enemy.active) path.add(enemy.next_waypoint);
     EnemyRecord record = {.active = enemy.active, .center = enemy.get_center()};
     enemy_records.push_back(record);
 }
 
+void Level::add_enemies(const Enemy& prototype, u64 count) {
+    if (count == 0) return;
+    mark_dirty(section_bit(SECTION_ENTITIES));
+    size_t first = enemies.size();
+    enemies.insert(enemies.end(), count, prototype);
+    EnemyRecord record = {.active = prototype.active, .center = prototype.get_center()};
+    enemy_records.insert(enemy_records.end(), count, record);
+    if (prototype.active) path.add(prototype.next_waypoint, (u32)count);
+
+    Enemy* added = enemies.data() + first;
+    u32 id = object_id_counter;
+    for (u64 i = 0; i < count; ++i) {
+        added[i].id = id + i;
+    }
+    object_id_counter += (u32)count;
+}
+
+void Level::hot_swap(Level&& loaded) {
+    mark_dirty(ALL_SECTIONS);
+    // a flow job still running was for the old map, its result is dropped
+    flow_job = {};
+    flow_changes.clear();
+
+    bool same_path = map->waypoints.size() == loaded.map->waypoints.size() &&
+                     std::equal(map->waypoints.begin(), map->waypoints.end(), loaded.map->waypoints.begin(),
+                                [](Vector2 a, Vector2 b) { return a.x == b.x && a.y == b.y; });
+    // the ground is cached by seed, a kept seed keeps its tiles either way
+    if (!map->same_as(*loaded.map)) map = std::move(loaded.map);
+    if (!same_path) {
+        for (Enemy& enemy : enemies) enemy.find_nearest_waypoint(map->waypoints);
+    }
+
+    towers = std::move(loaded.towers);
+    for (Tower& tower : towers) tower.target_lock = false;
+    // the local towers went with the old ones
+    local_areas.clear();
+    local_flow_field.reset();
+    stats.tower_kills.assign(towers.size(), 0);
+    bullets.clear();
+
+    // the running round continues where it was in the new events
+    float round_time = active_round >= 0 ? rounds[active_round].time : 0.f;
+    rounds = std::move(loaded.rounds);
+    if (active_round >= (int)rounds.size()) active_round = (int)rounds.size() - 1;
+    if (active_round >= 0) {
+        Round& round = rounds[active_round];
+        round.time = round_time;
+        round.next_event = 0;
+        while (round.next_event < round.events.size() && round.events[round.next_event].start <= round_time) round.next_event++;
+    }
+
+    name = std::move(loaded.name);
+    rebuild_path_progress();
+}
+
 void Level::add_tower(Tower tower) {
+    mark_dirty(section_bit(SECTION_TOWERS));
     towers.push_back(tower);
-    map.add_rec(to_rec(tower.position, tower.size));
+    stats.tower_kills.resize(towers.size());
+    Rectangle rec = to_rec(tower.position, tower.size);
+    edit_map().add_rec(rec);
+    if (get_flow_field()) flow_changes.push_back({rec, true});
 }
 
-void Level::update_enemies() {
+void Level::add_local_tower(Tower tower) {
+    mark_dirty(section_bit(SECTION_TOWERS));
+    towers.push_back(tower);
+    stats.tower_kills.resize(towers.size());
+    Rectangle rec = to_rec(tower.position, tower.size);
+    local_areas.push_back(rec);
+    if (get_flow_field()) flow_changes.push_back({rec, true});
+}
+
+bool Level::check_free(Rectangle rec) const {
+    for (Rectangle occ : local_areas) {
+        if (CheckCollisionRecs(rec, occ)) return false;
+    }
+    return map->check_free(rec);
+}
+
+void Level::remove_tower(u32 index) {
+    assert(index < towers.size());
+    mark_dirty(section_bit(SECTION_TOWERS) | section_bit(SECTION_ENTITIES));
+    Rectangle rec = to_rec(towers[index].position, towers[index].size);
+    auto same_rec = [rec](Rectangle occ) {
+        return occ.x == rec.x && occ.y == rec.y && occ.width == rec.width && occ.height == rec.height;
+    };
+    auto local = std::find_if(local_areas.rbegin(), local_areas.rend(), same_rec);
+    if (local != local_areas.rend()) local_areas.erase(std::next(local).base());
+    else edit_map().remove_rec(rec);
+    if (get_flow_field()) {
+        flow_changes.push_back({rec, false});
+        // cells the rectangle shares with a neighbour stay blocked
+        float cell = map->flow_cell_size;
+        Rectangle around = {rec.x - cell, rec.y - cell, rec.width + 2.f * cell, rec.height + 2.f * cell};
+        for (const std::vector<Rectangle>* areas : {&map->occupied_areas, &local_areas}) {
+            for (Rectangle occ : *areas) {
+                if (CheckCollisionRecs(occ, around)) flow_changes.push_back({occ, true});
+            }
+        }
+    }
+
+    u32 last = (u32)towers.size() - 1;
+    for (Projectile& bullet : bullets) {
+        if (bullet.tower_index == index) bullet.active = false;
+        else if (bullet.tower_index == last) bullet.tower_index = index;
+    }
+    remove_inactive_elements(bullets);
+    towers[index] = towers[last];
+    towers.pop_back();
+    stats.tower_kills[index] = stats.tower_kills[last];
+    stats.tower_kills.pop_back();
+}
+
+void Level::insert_tower(u32 index, Tower tower, u64 kills) {
+    assert(index <= towers.size());
+    add_tower(tower);
+    u32 last = (u32)towers.size() - 1;
+    stats.tower_kills[last] = kills;
+    if (index == last) return;
+    for (Projectile& bullet : bullets) {
+        if (bullet.tower_index == index) bullet.tower_index = last;
+    }
+    std::swap(towers[index], towers[last]);
+    std::swap(stats.tower_kills[index], stats.tower_kills[last]);
+}
+
+void Level::update_enemies(float dt) {
+    const std::vector<Vector2>& waypoints = map->waypoints;
+    const FlowField* flow_field = get_flow_field();
+    if (path.waypoint_count() != waypoints.size()) rebuild_path_progress();
+    path.begin_pass();
     for (Enemy& enemy : enemies) {
-        enemy.update(map.waypoints);
+        u32 segment = enemy.next_waypoint;
+        enemy.update(*map, flow_field, dt);
         enemy_records[enemy.id].active = enemy.active;
         enemy_records[enemy.id].center = enemy.get_center();
+        enemy_records[enemy.id].velocity = Vector2Scale(Vector2Normalize(enemy.direction), enemy.active ? enemy.get_speed() : 0.f);
+        if (enemy.active == false) {
+            if (enemy.hp > 0.f) {
+                stats.leaked++;
+                log_full(LOG_COMBAT, "enemy {} leaked at t = {}", enemy.id, time);
+            }
+            else stats.killed++;
+            path.remove(segment);
+            continue;
+        }
+        path.move(segment, enemy.next_waypoint);
+        path.record(enemy.next_waypoint, enemy.get_center(), waypoints, enemy.id);
     }
     remove_inactive_elements(enemies);
 }
 
-void Level::update_bullets(Rectangle game_boundary) {
-    for (Projectile& bullet : bullets) {
-        bullet.update(enemies, enemy_records, game_boundary);
-    } 
+void Level::rebuild_path_progress() {
+    path.build(map->waypoints);
+    for (const Enemy& enemy : enemies) {
+        if (enemy.active) path.add(enemy.next_waypoint);
+    }
+}
+
+void Level::update_bullets(Rectangle game_boundary, float dt) {
+    stats.ticks++;
+    stats.bullet_ticks += bullets.size();
+
+    // small batches stay on this thread, parallel_for runs a single chunk inline
+    const u64 grain = 512;
+    damage.reset((bullets.size() + grain - 1) / grain);
+    std::atomic<u64> hits = 0;
+    job_pool().parallel_for(bullets.size(), [&](u64 i) {
+        Projectile& bullet = bullets[i];
+        std::vector<DamageEvent>& events = damage.buffers[i / grain];
+        if (!bullet.update(enemies, enemy_records, enemy_grid, game_boundary, dt, events)) return;
+        hits.fetch_add(1, std::memory_order_relaxed);
+        float splash_radius = bullet.get_archetype().splash_radius;
+        if (splash_radius > 0.f) {
+            add_area_damage(bullet.position, splash_radius, bullet.damage, bullet.tower_index, events.back().enemy, events);
+        }
+    }, grain);
+    stats.hits += hits.load();
+    damage.apply(enemies, stats.tower_kills);
     remove_inactive_elements(bullets);
 }
 
-void Level::update_spawners() {
-    int i = 0;
-    for (EnemySpawner& spawner: spawners) {
-        if (spawner.active == false) continue;
-        spawner.update(*this);
-        i++;
+void DamageQueue::reset(size_t count) {
+    if (buffers.size() < count) buffers.resize(count);
+    for (std::vector<DamageEvent>& buffer : buffers) buffer.clear();
+}
+
+u64 DamageQueue::apply(std::vector<Enemy>& enemies, std::vector<u64>& tower_kills) {
+    for (std::vector<DamageEvent>& buffer : buffers) {
+        events.insert(events.end(), buffer.begin(), buffer.end());
+        buffer.clear();
     }
+    // the queue position in the key keeps ties in order, stable_sort would
+    // allocate a temporary buffer every tick
+    order.resize(events.size());
+    for (u32 i = 0; i < events.size(); ++i) order[i] = (u64)events[i].enemy << 32 | i;
+    std::sort(order.begin(), order.end());
+
+    u64 kills = 0;
+    for (u64 key : order) {
+        const DamageEvent& event = events[(u32)key];
+        Enemy& enemy = enemies[event.enemy];
+        // later hits on an enemy that already died this tick are overkill
+        if (enemy.active == false) continue;
+        enemy.get_hit(event.damage);
+        if (enemy.active) continue;
+        kills++;
+        if (event.tower < tower_kills.size()) tower_kills[event.tower]++;
+    }
+    events.clear();
+    return kills;
+}
+
+void Level::update_spawners() {
+    scheduler.update(*this);
 }
 
-void Level::update_towers() {
-    for (Tower& tower : towers) {
-        tower.update(enemies, enemy_records);
-        if (tower.shot_ready()) {
+void Level::update_towers(float dt) {
+    build_enemy_grid();
+    aim.clear();
+    for (u32 i = 0; i < towers.size(); ++i) {
+        Tower& tower = towers[i];
+        tower.update(enemies, enemy_records, enemy_grid, dt);
+        if (tower.type == TOWER_AURA) {
+            while (tower.target_lock && tower.shot_ready()) {
+                add_area_damage(tower.get_center(), tower.get_range(), tower.get_damage(), i, UINT32_MAX, damage.events);
+                tower.shoot();
+            }
+            continue;
+        }
+        if (tower.get_archetype().projectile != SEEK && tower.target_lock && tower.shot_ready()) {
+            aim.add(i, tower.get_center(), enemy_records[tower.target_id]);
+            continue;
+        }
+        while (tower.target_lock && tower.shot_ready()) {
             spawn_bullet(tower);
         }
     }     
+
+    if (aim.size() == 0) return;
+    // every straight shooting archetype has the same speed for now
+    aim.solve(PROJECTILE_ARCHETYPES[STRAIGHT].speed);
+    for (u32 i = 0; i < aim.size(); ++i) {
+        Tower& tower = towers[aim.tower[i]];
+        tower.direction = {aim.dx[i], aim.dy[i]};
+        while (tower.shot_ready()) {
+            spawn_bullet(tower);
+        }
+    }
+}
+
+void Level::build_enemy_grid() {
+    grid_points.resize(enemies.size());
+    Vector2 padding = {0.f, 0.f};
+    for (u32 i = 0; i < enemies.size(); ++i) {
+        grid_points[i] = enemies[i].get_center();
+        padding.x = std::max(padding.x, enemies[i].boundary.width / 2.f);
+        padding.y = std::max(padding.y, enemies[i].boundary.height / 2.f);
+    }
+    enemy_grid.build(get_bounds(), 32.f, grid_points.data(), (u32)grid_points.size(), padding);
 }
 
-void Level::update_round() {
+void Level::add_area_damage(Vector2 center, float radius, float amount, u32 tower, u32 skip, std::vector<DamageEvent>& events) const {
+    enemy_grid.for_each_in_radius(center, radius, [&](u32 i) {
+        if (i == skip || enemies[i].active == false) return;
+        events.push_back({.enemy = i, .tower = tower, .damage = amount});
+    });
+}
+
+void AimBatch::clear() {
+    tower.clear();
+    dx.clear();
+    dy.clear();
+    vx.clear();
+    vy.clear();
+}
+
+void AimBatch::add(u32 tower_index, Vector2 muzzle, const EnemyRecord& target) {
+    tower.push_back(tower_index);
+    dx.push_back(target.center.x - muzzle.x);
+    dy.push_back(target.center.y - muzzle.y);
+    vx.push_back(target.velocity.x);
+    vy.push_back(target.velocity.y);
+}
+
+void AimBatch::solve(float projectile_speed) {
+    // |d + v t| = s t  =>  (v.v - s^2) t^2 + 2 (d.v) t + d.d = 0
+    float ss = projectile_speed * projectile_speed;
+    u32 n = (u32)size();
+    float* x = dx.data();
+    float* y = dy.data();
+    const float* u = vx.data();
+    const float* v = vy.data();
+    for (u32 i = 0; i < n; ++i) {
+        float a = u[i] * u[i] + v[i] * v[i] - ss;
+        float b = x[i] * u[i] + y[i] * v[i];
+        float c = x[i] * x[i] + y[i] * y[i];
+        float disc = std::max(b * b - a * c, 0.f);
+        // a < 0 when the projectile is faster, then this is the only positive root
+        float t = (b + sqrtf(disc)) / std::max(-a, 1e-6f);
+        t = a < 0.f ? t : 0.f;
+        x[i] += u[i] * t;
+        y[i] += v[i] * t;
+    }
+}
+
+void Level::update_round(float dt) {
     assert(active_round < (int)rounds.size());
 
     if (active_round >= 0)
-        rounds[active_round].update(enemies, spawners);
+        rounds[active_round].update(*this, dt);
+}
+
+static std::shared_ptr<const FlowField> apply_flow_changes(std::shared_ptr<const FlowField> base, const std::vector<FlowChange>& changes) {
+    std::shared_ptr<FlowField> field = std::make_shared<FlowField>(*base);
+    std::vector<u32> changed;
+    for (const FlowChange& change : changes) field->set_blocked(change.rec, change.blocked, changed);
+    field->repair(changed);
+    return field;
+}
+
+void Level::update_flow_field(bool wait) {
+    // a level with local towers keeps its field to itself, the map stays shared
+    auto publish = [this](std::shared_ptr<const FlowField> field) {
+        if (local_flow_field || !local_areas.empty()) local_flow_field = std::move(field);
+        else edit_map().flow_field = std::move(field);
+    };
+    if (flow_job.valid()) {
+        if (!wait && flow_job.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+        publish(flow_job.get());
+    }
+    if (flow_changes.empty()) return;
+    if (!get_flow_field()) {
+        flow_changes.clear();
+        return;
+    }
+
+    std::shared_ptr<const FlowField> base = local_flow_field ? local_flow_field : map->flow_field;
+    std::vector<FlowChange> changes = std::move(flow_changes);
+    flow_changes.clear();
+    if (wait) {
+        publish(apply_flow_changes(base, changes));
+        return;
+    }
+
+    // enemies keep steering by the old field until the new one is done
+    std::shared_ptr<std::promise<std::shared_ptr<const FlowField>>> promise =
+        std::make_shared<std::promise<std::shared_ptr<const FlowField>>>();
+    flow_job = promise->get_future();
+    job_pool().submit([promise, base, changes]() {
+        promise->set_value(apply_flow_changes(base, changes));
+    });
 }
 
 void Level::spawn_bullet(Tower& tower) {
@@ -884,66 +2061,113 @@ void Level::spawn_bullet(Tower& tower) {
 
     Projectile bullet;
     bullet.position = tower.get_center();
-    bullet.direction = tower.direction;
-    bullet.damage += tower.damage;
-    // TODO convert method 
-    bullet.type = (Projectile_Type)tower.type;
+    bullet.direction = Vector2Normalize(tower.direction);
+    bullet.type = tower.get_archetype().projectile;
+    bullet.damage = bullet.get_archetype().damage + tower.get_damage();
     bullet.target_id = tower.target_id;
+    bullet.tower_index = (u32)(&tower - towers.data());
     bullets.push_back(bullet);
     tower.shoot();
+    stats.shots++;
 }
 
-std::string Level::to_string(const char* prefix) {
+std::pmr::string Level::to_string(const char* prefix, std::pmr::memory_resource* memory) const {
     if (prefix == nullptr) prefix = "";
-    std::string out;
+    char number[32];
+    std::pmr::string out(memory);
     out += prefix; out += "Level "; out += name; out += "\n";
-    out += prefix; out += "active enemies: "; out += std::to_string(enemies.size()); out += "\n";  
-    out += prefix; out += "active buildings: "; out += std::to_string(towers.size()); out += "\n";  
+    snprintf(number, sizeof(number), "%zu", enemies.size());
+    out += prefix; out += "active enemies: "; out += number; out += "\n";  
+    snprintf(number, sizeof(number), "%zu", towers.size());
+    out += prefix; out += "active buildings: "; out += number; out += "\n";  
     return out;
 }
 
-void EnemySpawner::update(Level& level) {
-    if (active == false) return;
-    time_since_spawn += GetFrameTime();
-    if (time_since_spawn < delay) return;
-    spawn(level);
+static bool spawns_later(const EnemySpawner& a, const EnemySpawner& b) {
+    return a.next_spawn > b.next_spawn;
+}
+
+void SpawnScheduler::schedule(const EnemySpawner& spawner) {
+    spawners.push_back(spawner);
+    std::push_heap(spawners.begin(), spawners.end(), spawns_later);
+}
+
+static bool same_placement(const EnemySpawner& a, const EnemySpawner& b) {
+    return a.type == b.type && a.position.x == b.position.x && a.position.y == b.position.y &&
+           a.delay == b.delay && a.max == b.max;
+}
+
+bool SpawnScheduler::remove(const EnemySpawner& spawner) {
+    auto found = std::find_if(spawners.begin(), spawners.end(), [&](const EnemySpawner& s) { return same_placement(s, spawner); });
+    if (found == spawners.end()) return false;
+    size_t index = found - spawners.begin();
+    spawners[index] = spawners.back();
+    spawners.pop_back();
+    if (index == spawners.size()) return true;
+    // the moved one may belong higher or lower in the heap
+    std::push_heap(spawners.begin(), spawners.begin() + index + 1, spawns_later);
+    for (size_t child = 2 * index + 1; child < spawners.size(); child = 2 * index + 1) {
+        if (child + 1 < spawners.size() && spawns_later(spawners[child], spawners[child + 1])) child++;
+        if (!spawns_later(spawners[index], spawners[child])) break;
+        std::swap(spawners[index], spawners[child]);
+        index = child;
+    }
+    return true;
+}
+
+void SpawnScheduler::update(Level& level) {
+    while (!spawners.empty() && spawners.front().next_spawn <= level.time) {
+        std::pop_heap(spawners.begin(), spawners.end(), spawns_later);
+        EnemySpawner& spawner = spawners.back();
+        spawner.spawn(level);
+        if (spawner.active) {
+            std::push_heap(spawners.begin(), spawners.end(), spawns_later);
+        } else {
+            spawners.pop_back();
+        }
+    }
 }
 
 void EnemySpawner::spawn(Level& level) {
-    Enemy enemy;
-    enemy.type = type;
-    enemy.set_position(position);
-    level.add_enemy(enemy);
-    time_since_spawn = 0.f;
-    spawned++;
+    if (active == false) return;
+    // catch up on every spawn the last tick skipped over
+    u64 due = 1;
+    if (delay > 0.f) due += (u64)((level.time - next_spawn) / delay);
+    else if (max > 0) due = max - spawned;
     // max = 0 => infinite spawn
-    if (max == 0) return;
+    if (max > 0) due = std::min(due, max - spawned);
 
-    if (spawned >= max) {
+    Enemy enemy = Enemy::from_type(type);
+    enemy.set_position(position);
+    level.add_enemies(enemy, due);
+    spawned += due;
+    next_spawn = delay > 0.f ? next_spawn + due * delay : std::nextafter(level.time, INFINITY);
+
+    if (max > 0 && spawned >= max) {
         active = false;
     }
 }
 
-void Tower::update(const std::vector<Enemy>& enemies, const std::vector<EnemyRecord>& enemy_records) {
-    time_since_shot += GetFrameTime();
+void Tower::update(const std::vector<Enemy>& enemies, const std::vector<EnemyRecord>& enemy_records, const SpatialGrid& enemy_grid, float dt) {
+    // idle towers don't save up a burst
+    float reload_time = get_reload_time();
+    time_since_shot = std::min(time_since_shot + dt, reload_time + dt);
     if (target_lock == false) {
-        u64 i = 0;
-        for (const Enemy& enemy: enemies) {
-            if (enemy.active == false) continue;
-            Vector2 line_to_target = Vector2Subtract(enemy.get_center(), position);
-            if (Vector2Length(line_to_target) <= range) {
-                target_id = enemy.id;
-                target_lock = true;
-                break;
-            }
-            i++;
+        // first one in the array, like a linear scan would find
+        u32 first = UINT32_MAX;
+        enemy_grid.for_each_in_radius(position, get_range(), [&](u32 i) {
+            if (enemies[i].active && i < first) first = i;
+        });
+        if (first != UINT32_MAX) {
+            target_id = enemies[first].id;
+            target_lock = true;
         }
     }
 
     if (target_lock) {
         EnemyRecord target = enemy_records[target_id];
         Vector2 line_to_target = Vector2Subtract(target.center, position);
-        if (target.active == false || Vector2Length(line_to_target) > range) {
+        if (target.active == false || Vector2Length(line_to_target) > get_range()) {
             target_lock = false;
             return;
         }
@@ -954,6 +2178,7 @@ void Tower::update(const std::vector<Enemy>& enemies, const std::vector<EnemyRec
 }
 
 void Tower::turn_to_target(Vector2 target_dir) {
+    float turn_speed = get_archetype().turn_speed;
     float angle_dif = Vector2Angle(target_dir, direction);
     if (angle_dif <= turn_speed) {
         direction = target_dir;
@@ -966,57 +2191,95 @@ void Tower::turn_to_target(Vector2 target_dir) {
 }
 
 bool Tower::shot_ready() {
-    return time_since_shot >= reload_time;
+    return time_since_shot >= get_reload_time();
 } 
 
 void Tower::shoot() {
-    time_since_shot = 0.f;
+    // the remainder carries over, long ticks fire more than once
+    time_since_shot -= get_reload_time();
 }
 
 Vector2 Tower::get_center() const {
     return {position.x + size.x / 2.f, position.y + size.y / 2.f};
 }
-void Projectile::update(std::vector<Enemy>& enemies, std::vector<EnemyRecord>& enemy_records, Rectangle game_boundary) {
-    if (active == false) return;
+bool Projectile::update(const std::vector<Enemy>& enemies, const std::vector<EnemyRecord>& enemy_records, const SpatialGrid& enemy_grid,
+                        Rectangle game_boundary, float dt, std::vector<DamageEvent>& events) {
+    switch (type) {
+        case STRAIGHT: return update_as<STRAIGHT>(enemies, enemy_records, enemy_grid, game_boundary, dt, events);
+        case SEEK: return update_as<SEEK>(enemies, enemy_records, enemy_grid, game_boundary, dt, events);
+        case SPLASH: return update_as<SPLASH>(enemies, enemy_records, enemy_grid, game_boundary, dt, events);
+        default: return false;
+    }
+}
 
+template<Projectile_Type TYPE>
+bool Projectile::update_as(const std::vector<Enemy>& enemies, const std::vector<EnemyRecord>& enemy_records, const SpatialGrid& enemy_grid,
+                           Rectangle game_boundary, float dt, std::vector<DamageEvent>& events) {
+    constexpr float speed = PROJECTILE_ARCHETYPES[TYPE].speed;
+    constexpr float radius = PROJECTILE_ARCHETYPES[TYPE].radius;
+    if (active == false) return false;
 
-    Vector2 dir;
-    if (type == STRAIGHT) {
-        dir = Vector2Scale(direction, speed * GetFrameTime());
-    }
-    else if (type == SEEK) {
+
+    Vector2 dir = Vector2Scale(direction, speed * dt);
+    if constexpr (TYPE == SEEK) {
         // TODO:: find target -> array move event? listneres?
         EnemyRecord target = enemy_records.at(target_id);
         if (target.active == false) { 
             if (!target_lost) {
                 target_lost = true;
-                dir = Vector2Scale(Vector2Normalize(Vector2Subtract(target.center, position)), speed * GetFrameTime());
-                direction = dir;
+                // keeps flying the last way it went
+                direction = Vector2Normalize(Vector2Subtract(target.center, position));
             }
         }
         else {
-            dir = Vector2Scale(Vector2Normalize(Vector2Subtract(target.center, position)), speed * GetFrameTime());
+            dir = Vector2Scale(Vector2Normalize(Vector2Subtract(target.center, position)), speed * dt);
         }
         if (target_lost) { 
-            dir = direction;
+            dir = Vector2Scale(direction, speed * dt);
         }
     }
 
-    position = Vector2Add(position, dir);
+    // swept against every enemy near the path so nothing gets tunneled through
+    // on big steps, the earliest hit along the way wins
+    Vector2 start = position;
+    u32 hit_enemy = UINT32_MAX;
+    float hit_time = 1.f;
+    Rectangle swept = {std::min(start.x, start.x + dir.x) - radius, std::min(start.y, start.y + dir.y) - radius,
+                       fabsf(dir.x) + 2.f * radius, fabsf(dir.y) + 2.f * radius};
+    enemy_grid.for_each_overlapping(swept, [&](u32 i) {
+        // dead ones stay in the array until update_enemies
+        if (enemies[i].active == false) return;
+        float toi;
+        if (!sweep_circle_rec(start, dir, radius, enemies[i].boundary, toi)) return;
+        if (toi < hit_time || (toi == hit_time && i < hit_enemy)) {
+            hit_time = toi;
+            hit_enemy = i;
+        }
+    });
 
-    if (!CheckCollisionCircleRec(position, radius, game_boundary)) {
+    position = Vector2Add(start, Vector2Scale(dir, hit_time));
+
+    if (hit_enemy != UINT32_MAX) {
         active = false;
-        return;
+        events.push_back({.enemy = hit_enemy, .tower = tower_index, .damage = damage});
+        return true;
     }
 
-    for (Enemy& enemy : enemies) {
-        if (CheckCollisionCircleRec(position, radius, enemy.boundary)) {
-            active = false;
-            enemy.get_hit(damage);
-            return;
-        }
+    if (!CheckCollisionCircleRec(position, radius, game_boundary)) {
+        active = false;
     }
+    return false;
+}
+Enemy Enemy::from_type(Enemy_Type type) {
+    const EnemyArchetype& archetype = ENEMY_ARCHETYPES[type];
+    Enemy enemy;
+    enemy.type = type;
+    enemy.hp = archetype.hp;
+    enemy.boundary.width = archetype.size.x;
+    enemy.boundary.height = archetype.size.y;
+    return enemy;
 }
+
 void Enemy::set_position(Vector2 pos) {
     boundary.x = pos.x;
     boundary.y = pos.y;
@@ -1030,32 +2293,73 @@ Vector2 Enemy::get_center() const {
     return {boundary.x + boundary.width / 2.f, boundary.y + boundary.height / 2.f};
 }
 
-void Enemy::update(const std::vector<Vector2>& waypoints) {
+void Enemy::update(const Map& map, const FlowField* field, float dt) {
     if (hp <= 0.f) active = false;
     if (active == false) return;
     if (hit) hit = false;
 
-    assert(next_waypoint < waypoints.size());
+    if (field && follow_flow_field(*field, dt)) return;
 
-    Vector2 wp = waypoints[next_waypoint]; 
-    Vector2 pos = get_center();
-    float distance = Vector2Length(Vector2Subtract(wp, pos));
+    const std::vector<Vector2>& waypoints = map.waypoints;
+    assert(next_waypoint < waypoints.size());
 
-    direction = Vector2Scale(Vector2Normalize(Vector2Subtract(wp, get_center())), speed * GetFrameTime());
-    pos = Vector2Add(pos, direction);
+    // walks the whole step along the path, a big step can pass several waypoints
+    Vector2 start = get_center();
+    Vector2 pos = start;
+    float step = get_speed() * dt;
+    while (next_waypoint < waypoints.size()) {
+        Vector2 wp = waypoints[next_waypoint];
+        float distance = Vector2Length(Vector2Subtract(wp, pos));
+        if (distance > step) {
+            pos = Vector2Add(pos, Vector2Scale(Vector2Subtract(wp, pos), step / distance));
+            break;
+        }
+        pos = wp;
+        step -= distance;
+        //find_nearest_waypoint(waypoints);
+        next_waypoint++;
+    }
+    direction = Vector2Subtract(pos, start);
     boundary.x = pos.x - boundary.width / 2.f;
     boundary.y = pos.y - boundary.height / 2.f;
 
-    if (distance < 10.f) {
-        //find_nearest_waypoint(waypoints);
-        next_waypoint++;
-        if (next_waypoint >= waypoints.size()) {
-            active = false;
-        }
+    if (next_waypoint >= waypoints.size()) {
+        next_waypoint = waypoints.size() - 1;
+        active = false;
     }
 }
 
 
+bool Enemy::follow_flow_field(const FlowField& field, float dt) {
+    Vector2 pos = get_center();
+    u32 cell = field.cell_at(pos);
+    // reached the exit
+    if (field.distance[cell] == 0) {
+        active = false;
+        return true;
+    }
+    Vector2 dir = FLOW_DIRECTIONS[field.direction[cell]];
+    if (dir.x == 0.f && dir.y == 0.f) return false;
+
+    // at most half a cell at a time so big steps can't skip into blocked cells
+    Vector2 start = pos;
+    float step = get_speed() * dt;
+    float max_step = field.cell_size * 0.5f;
+    while (step > 0.f) {
+        float part = std::min(step, max_step);
+        pos = Vector2Add(pos, Vector2Scale(dir, part));
+        step -= part;
+        cell = field.cell_at(pos);
+        if (field.distance[cell] == 0) break;
+        dir = FLOW_DIRECTIONS[field.direction[cell]];
+        if (dir.x == 0.f && dir.y == 0.f) break;
+    }
+    direction = Vector2Subtract(pos, start);
+    boundary.x = pos.x - boundary.width / 2.f;
+    boundary.y = pos.y - boundary.height / 2.f;
+    return true;
+}
+
 void Enemy::find_nearest_waypoint(const std::vector<Vector2>& waypoints) {
     if (waypoints.size() == 0) return;
     float min_distance = 999999.f;
@@ -1078,23 +2382,59 @@ void Enemy::get_hit(float dmg) {
     hit = true;
 }
 Map::Map(Rectangle bounds): width(bounds.width), height(bounds.height) {
-    Image img = GenImageColor(width, height, BROWN);
-    ground_tex = LoadTextureFromImage(img);
-    UnloadImage(img);
-
     waypoints.reserve(100);
 }
 
 
-void Map::ground_tex_from_image(const Image& img) {
-    UnloadTexture(ground_tex);
-    ground_tex = LoadTextureFromImage(img);
+Map Map::clone() const {
+    Map map;
+    map.width = width;
+    map.height = height;
+    map.ground_seed = ground_seed;
+    map.road_width = road_width;
+    map.waypoints = waypoints;
+    map.occupied_areas = occupied_areas;
+    map.use_flow_field = use_flow_field;
+    map.flow_cell_size = flow_cell_size;
+    map.flow_field = flow_field;
+    return map;
+}
+
+bool Map::same_as(const Map& other) const {
+    auto same_bytes = [](const auto& a, const auto& b) {
+        return a.size() == b.size() && (a.empty() || memcmp(a.data(), b.data(), a.size() * sizeof(a[0])) == 0);
+    };
+    return width == other.width && height == other.height && ground_seed == other.ground_seed &&
+           road_width == other.road_width && use_flow_field == other.use_flow_field &&
+           flow_cell_size == other.flow_cell_size && same_bytes(waypoints, other.waypoints) &&
+           same_bytes(occupied_areas, other.occupied_areas);
 }
 
 void Map::add_rec(Rectangle rec) {
     occupied_areas.push_back(rec);
 }
 
+bool Map::remove_rec(Rectangle rec) {
+    // the most recent placement is the usual one to go
+    for (size_t i = occupied_areas.size(); i-- > 0;) {
+        Rectangle occ = occupied_areas[i];
+        if (occ.x != rec.x || occ.y != rec.y || occ.width != rec.width || occ.height != rec.height) continue;
+        occupied_areas.erase(occupied_areas.begin() + i);
+        return true;
+    }
+    return false;
+}
+
+void Map::build_flow_field() {
+    if (waypoints.empty()) return;
+    std::shared_ptr<FlowField> field = std::make_shared<FlowField>();
+    field->init(width, height, flow_cell_size);
+    std::vector<u32> changed;
+    for (Rectangle rec : occupied_areas) field->set_blocked(rec, true, changed);
+    field->compute(waypoints.back());
+    flow_field = field;
+}
+
 bool Map::check_free(Rectangle rec) const {
     for (Rectangle occ : occupied_areas) {
         if (CheckCollisionRecs(rec, occ)) return false;
@@ -1102,24 +2442,34 @@ bool Map::check_free(Rectangle rec) const {
     return true;
 }
 
-void Round::update(std::vector<Enemy>& enemies, std::vector<EnemySpawner>& spawners) {
+void Round::update(Level& level, float dt) {
     assert (next_event <= events.size());
 
-    time += GetFrameTime();
+    time += dt;
     while (next_event < events.size() && time >= events[next_event].start) {
-        events[next_event].spawn(enemies, spawners);
+        events[next_event].spawn(level);
         next_event++;
     };
 }
 
-void SpawnEvent::spawn(std::vector<Enemy>& enemies, std::vector<EnemySpawner>& spawners) {
+void SpawnEvent::spawn(Level& level) {
     for (int i = 0; i < ENEMY_TYPE_MAX; ++i) {
+        // a spawner with max = 0 would never stop
+        if (enemies[i] == 0) continue;
+        // burst wave, everything at once
+        if (delay <= 0.f) {
+            Enemy enemy = Enemy::from_type((Enemy_Type)i);
+            enemy.set_position(position);
+            level.add_enemies(enemy, enemies[i]);
+            continue;
+        }
         EnemySpawner spawner;
         spawner.position = position;
-        spawner.max = this->enemies[i];
+        spawner.max = enemies[i];
         spawner.type = (Enemy_Type)i;
         spawner.delay = delay;
-        spawners.push_back(spawner);
+        spawner.next_spawn = level.time + delay;
+        level.scheduler.schedule(spawner);
     }
 }
 
@@ -0,0 +1,194 @@
+#pragma once
+#include <atomic>
+#include <cmath>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "raylib.h"
+#include "common.hpp"
+#include "jobs.hpp"
+#include "noise.hpp"
+
+// the ground of every map, cut into square tiles. A tile is generated on the
+// job pool the first time it is seen and uploaded by the main thread, a few per
+// frame. Once more than budget tiles are resident the least recently drawn go
+// first. Tile lod n covers 2^n times the width at the same resolution, so a
+// zoomed out view needs about as many tiles as a zoomed in one and the memory
+// stays bounded no matter how big the map is.
+//
+// The noise only depends on the seed, maps with the same seed share tiles.
+struct GroundTiles {
+    static constexpr int TILE_SIZE = 256;
+    static constexpr int MAX_LOD = 10;
+
+    struct Tile {
+        Texture texture = {};
+        u64 last_used_frame = 0;
+        std::list<u64>::iterator lru;
+    };
+
+    // main thread only
+    std::unordered_map<u64, Tile> tiles;
+    // most recently drawn first
+    std::list<u64> lru;
+    // requested and not uploaded yet
+    std::unordered_set<u64> in_flight;
+    u64 frame = 0;
+    // 64 MiB of RGBA at the default size
+    u32 budget = 256;
+    u32 max_uploads_per_frame = 4;
+    u32 max_in_flight = 16;
+
+    // generated on the pool, waiting for upload
+    std::mutex mutex;
+    std::vector<std::pair<u64, Image>> finished;
+    std::atomic<u32> running = 0;
+    // begin_frame's share of finished, kept to reuse the storage
+    std::vector<std::pair<u64, Image>> uploading;
+
+    GroundTiles();
+    ~GroundTiles();
+
+    GroundTiles(const GroundTiles&) = delete;
+    GroundTiles& operator=(const GroundTiles&) = delete;
+
+    static u64 make_key(u32 seed, int lod, int x, int y) {
+        return ((u64)seed << 32) | ((u64)lod << 28) | ((u64)(x & 0x3fff) << 14) | (u64)(y & 0x3fff);
+    }
+
+    // coarsest lod that still has a texel per screen pixel
+    static int lod_for_zoom(float zoom);
+
+    // world pixels one tile of lod covers
+    static float get_span(int lod) { return (float)(TILE_SIZE << lod); }
+
+    // uploads what the pool finished and evicts down to budget, once per frame
+    // before drawing
+    void begin_frame();
+
+    // the tile if it is resident, marks it used this frame
+    const Texture* find(u32 seed, int lod, int x, int y);
+
+    // starts generating the tile unless it's resident or already coming.
+    // Silently does nothing while max_in_flight are queued, visible tiles get
+    // asked for again next frame
+    void request(u32 seed, int lod, int x, int y);
+
+    u32 size() const { return (u32)tiles.size(); }
+
+    u32 get_pending() const { return (u32)in_flight.size(); }
+
+    size_t get_texture_bytes() const;
+
+    // waits for the pool and drops every tile, before the window closes
+    void clear();
+
+    void evict(std::unordered_map<u64, Tile>::iterator it);
+
+    void wait_for_jobs();
+};
+
+// shared by every map, created on first use
+GroundTiles& ground_tiles() {
+    static GroundTiles tiles;
+    return tiles;
+}
+
+GroundTiles::GroundTiles() {
+    // statics die in reverse order, the pool has to outlive our jobs
+    job_pool();
+    max_in_flight = std::max(4u, job_pool().size() * 2);
+}
+
+GroundTiles::~GroundTiles() {
+    clear();
+}
+
+int GroundTiles::lod_for_zoom(float zoom) {
+    if (zoom >= 1.f) return 0;
+    int lod = (int)floorf(log2f(1.f / zoom));
+    return std::clamp(lod, 0, MAX_LOD);
+}
+
+void GroundTiles::begin_frame() {
+    ++frame;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        u32 count = std::min<u32>((u32)finished.size(), max_uploads_per_frame);
+        uploading.assign(finished.begin(), finished.begin() + count);
+        finished.erase(finished.begin(), finished.begin() + count);
+    }
+    for (auto& [key, img] : uploading) {
+        in_flight.erase(key);
+        Tile& tile = tiles[key];
+        tile.texture = LoadTextureFromImage(img);
+        UnloadImage(img);
+        lru.push_front(key);
+        tile.lru = lru.begin();
+        tile.last_used_frame = frame;
+    }
+    uploading.clear();
+
+    // never what the last frame drew, a view bigger than the budget wins
+    while (tiles.size() > budget) {
+        auto it = tiles.find(lru.back());
+        if (it->second.last_used_frame + 1 >= frame) break;
+        evict(it);
+    }
+}
+
+const Texture* GroundTiles::find(u32 seed, int lod, int x, int y) {
+    auto it = tiles.find(make_key(seed, lod, x, y));
+    if (it == tiles.end()) return nullptr;
+    Tile& tile = it->second;
+    if (tile.last_used_frame != frame) {
+        tile.last_used_frame = frame;
+        lru.splice(lru.begin(), lru, tile.lru);
+    }
+    return &tile.texture;
+}
+
+void GroundTiles::request(u32 seed, int lod, int x, int y) {
+    u64 key = make_key(seed, lod, x, y);
+    if (in_flight.size() >= max_in_flight || in_flight.contains(key) || tiles.contains(key)) return;
+    in_flight.insert(key);
+    running.fetch_add(1);
+    job_pool().submit([this, key, seed, lod, x, y] {
+        NoiseParams params;
+        params.seed = seed;
+        float span = get_span(lod);
+        Image img = gen_noise_tile(x * span, y * span, TILE_SIZE, (float)(1 << lod), params);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.push_back({key, img});
+        }
+        running.fetch_sub(1);
+    });
+}
+
+size_t GroundTiles::get_texture_bytes() const {
+    return (size_t)tiles.size() * GetPixelDataSize(TILE_SIZE, TILE_SIZE, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+}
+
+void GroundTiles::evict(std::unordered_map<u64, Tile>::iterator it) {
+    // textures outlive the window when the map sits in a global
+    if (IsWindowReady()) UnloadTexture(it->second.texture);
+    lru.erase(it->second.lru);
+    tiles.erase(it);
+}
+
+void GroundTiles::wait_for_jobs() {
+    while (running.load() != 0) std::this_thread::yield();
+}
+
+void GroundTiles::clear() {
+    wait_for_jobs();
+    for (auto& [key, img] : finished) UnloadImage(img);
+    finished.clear();
+    in_flight.clear();
+    while (!tiles.empty()) evict(tiles.begin());
+}
@@ -2,22 +2,53 @@
 
 #include <iostream>
 #include <iterator>
+#include <string>
 #include <vector>
+#include "common.hpp"
 #include "raylib.h"
 
 namespace GUI {
 
+// what a MenuItem really is, so drawing can switch instead of dynamic_cast
+enum Item_Type : uint8_t {
+    ITEM_BUTTON,
+    ITEM_TEXTBOX,
+};
+
+// where and how big the text goes, computed on first draw and kept until the
+// text or the rectangle it is fitted into changes
+struct TextLayout {
+    bool valid = false;
+    Rectangle fitted_into = {};
+    Vector2 position = {};
+    float font_size = 0.f;
+};
+
 class MenuItem {
 public:
+    const Item_Type type;
     bool active = true;
     bool hovered = false;
+    // looks different since the gui was last drawn
+    bool dirty = true;
     Rectangle boundary;
 
     void (*on_click)() = nullptr;
     void (*on_release)() = nullptr;
 
+    // filled by the renderer
+    mutable TextLayout layout;
+
+    MenuItem(Item_Type type) : type(type) {}
+
+    void set_boundary(Rectangle rec) {
+        boundary = rec;
+        layout.valid = false;
+        dirty = true;
+    }
+
     virtual void update() {};
-    //virtual ~MenuItem() = default; 
+    //virtual ~MenuItem() = default;
 };
 
 class Button: public MenuItem {
@@ -29,9 +60,19 @@ public:
     Color bg_color = DARKGRAY;
     Color text_color = RAYWHITE;
 
+    Button() : MenuItem(ITEM_BUTTON) {}
+
+    void set_text(const char* new_text) {
+        text = new_text;
+        layout.valid = false;
+        dirty = true;
+    }
+
     void update() {
         if (active == false ) return;
 
+        bool was_hovered = hovered;
+        bool was_down = down;
         hovered = CheckCollisionPointRec(GetMousePosition(), boundary);
 
         // clicked
@@ -46,6 +87,8 @@ public:
             down = false;
             if (on_release) on_release();
         }
+
+        if (hovered != was_hovered || down != was_down) dirty = true;
     }
 
 };
@@ -55,6 +98,15 @@ struct TextBox: public MenuItem {
     Color text_color = RAYWHITE;
     std::string text;
 
+    TextBox() : MenuItem(ITEM_TEXTBOX) {}
+
+    void set_text(std::string new_text) {
+        if (new_text == text) return;
+        text = std::move(new_text);
+        layout.valid = false;
+        dirty = true;
+    }
+
     void update() {
 
     }
@@ -63,28 +115,52 @@ struct TextBox: public MenuItem {
 struct Menu {
     std::vector<MenuItem*> items;
     Rectangle boundary;
+    // hidden menus are neither updated nor drawn
+    bool visible = false;
 
     void layout_vertical(float padding = 1.f) {
         float offset = 0.f;
         Rectangle first_slot = { boundary.x, boundary.y, boundary.width, boundary.height / items.size() };
         for (MenuItem* item: items) {
-            item->boundary = first_slot;
-            item->boundary.y += offset;
-            offset += item->boundary.height + padding;
-        } 
+            Rectangle slot = first_slot;
+            slot.y += offset;
+            item->set_boundary(slot);
+            offset += slot.height + padding;
+        }
     }
 };
 
 
 struct Gui {
     std::vector<Menu> menues;
+    // bumped whenever something visible changed, the renderer redraws its
+    // cached gui texture only when this moved
+    u64 version = 1;
+
+    void set_visible(int menu, bool visible) {
+        if (menues[menu].visible == visible) return;
+        menues[menu].visible = visible;
+        ++version;
+    }
+
+    bool any_visible() const {
+        for (const Menu& menu : menues) {
+            if (menu.visible) return true;
+        }
+        return false;
+    }
 
     void update() {
+        bool changed = false;
         for (Menu& menu : menues) {
+            if (!menu.visible) continue;
             for (MenuItem* item: menu.items) {
                 item->update();
+                changed |= item->dirty;
+                item->dirty = false;
             }
         }
+        if (changed) ++version;
     }
 
 };
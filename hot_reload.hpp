@@ -0,0 +1,120 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "common.hpp"
+#include "file_watcher.hpp"
+#include "game.hpp"
+
+// reloads level files while the game runs. A changed file is parsed into a
+// fresh Level on the job pool, the main thread only swaps the result in
+// between ticks, see Level::hot_swap. A file saved again while its parse is
+// running is parsed once more after it.
+struct LevelReloader {
+    struct Parsed {
+        u32 file = 0;
+        // null when the file didn't parse, the running level stays
+        std::unique_ptr<Level> result;
+    };
+
+    FileWatcher watcher;
+    // per watched file
+    std::vector<u32> level_of_file;
+    std::vector<std::string> paths;
+    std::vector<bool> parsing;
+    std::vector<bool> again;
+    std::vector<u32> changed;
+
+    std::mutex mutex;
+    std::vector<Parsed> finished;
+    std::vector<Parsed> swapping;
+    std::atomic<u32> running = 0;
+
+    LevelReloader() = default;
+    ~LevelReloader();
+
+    LevelReloader(const LevelReloader&) = delete;
+    LevelReloader& operator=(const LevelReloader&) = delete;
+
+    // every level of game that came from a file
+    void watch(const Game& game);
+
+    // starts parses for changed files and swaps in the finished ones. Call
+    // from the main thread while no level is ticking
+    void update(Game& game);
+
+    void start_parse(u32 file);
+};
+
+LevelReloader::~LevelReloader() {
+    while (running.load() != 0) std::this_thread::yield();
+}
+
+void LevelReloader::watch(const Game& game) {
+    for (u32 i = 0; i < game.level_files.size(); ++i) {
+        const std::string& path = game.level_files[i];
+        if (path.empty()) continue;
+        if (watcher.watch(path) < 0) {
+            log_low(LOG_IO, "can't watch {}, no hot reload for it", path);
+            continue;
+        }
+        level_of_file.push_back(i);
+        paths.push_back(path);
+        parsing.push_back(false);
+        again.push_back(false);
+    }
+}
+
+void LevelReloader::update(Game& game) {
+    changed.clear();
+    watcher.poll(changed);
+    for (u32 file : changed) {
+        if (parsing[file]) again[file] = true;
+        else start_parse(file);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (finished.empty()) return;
+        swapping.swap(finished);
+    }
+    for (Parsed& parsed : swapping) {
+        u32 file = parsed.file;
+        parsing[file] = false;
+        u32 level = level_of_file[file];
+        if (parsed.result && level < game.levels.size()) {
+            game.levels[level].hot_swap(std::move(*parsed.result));
+            // the undo steps refer to towers that are gone
+            if ((int)level == game.active_level) game.editor.clear();
+            log_low(LOG_IO, "reloaded {} into level {}", paths[file], level);
+        }
+        if (again[file]) {
+            again[file] = false;
+            start_parse(file);
+        }
+    }
+    // what the swaps left of the loaded levels
+    swapping.clear();
+}
+
+void LevelReloader::start_parse(u32 file) {
+    parsing[file] = true;
+    running.fetch_add(1);
+    job_pool().submit([this, file, path = paths[file]] {
+        Parsed parsed;
+        parsed.file = file;
+        parsed.result = std::make_unique<Level>();
+        if (!parsed.result->load_from_file(path.c_str())) {
+            log_low(LOG_IO, "reload of {} failed, keeping the running level", path);
+            parsed.result.reset();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.push_back(std::move(parsed));
+        }
+        running.fetch_sub(1);
+    });
+}
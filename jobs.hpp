@@ -0,0 +1,236 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "common.hpp"
+
+// shared state of one parallel_for, recycled by the pool. Helpers aren't
+// tasks: the batch sits in the pool's open list until enough workers claimed
+// it, and the caller withdraws the claims nobody took before it returns.
+// Only helpers that are already running are waited for, so a batch is free
+// again when parallel_for returns, however long the task queue is.
+struct ParallelBatch {
+    std::atomic<u64> next_chunk = 0;
+    std::atomic<u64> done_chunks = 0;
+    // helpers still wanted, under the pool's mutex
+    u32 open_helpers = 0;
+    // claimed helpers that haven't finished, under mutex
+    u32 running_helpers = 0;
+    u64 count = 0;
+    u64 chunk_count = 0;
+    u64 grain = 1;
+    // fn(context, begin, end) runs the caller's function over [begin, end)
+    void (*fn)(void* context, u64 begin, u64 end) = nullptr;
+    void* context = nullptr;
+    std::mutex mutex;
+    std::condition_variable done;
+
+    void run_chunks();
+};
+
+// fixed size worker pool, tasks run in submit order
+struct ThreadPool {
+    std::vector<std::thread> workers;
+    // ring buffer, only grows when full
+    std::vector<std::function<void()>> tasks;
+    size_t task_head = 0;
+    size_t task_count = 0;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    // parallel_for state, one per parallel_for in progress
+    std::vector<std::unique_ptr<ParallelBatch>> batches;
+    std::vector<ParallelBatch*> free_batches;
+    // batches still wanting helpers, workers take these before tasks
+    std::vector<ParallelBatch*> open_batches;
+
+    // thread_count = 0 => one worker per core
+    ThreadPool(u32 thread_count = 0);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    u32 size() const { return (u32)workers.size(); }
+
+    void submit(std::function<void()> task);
+
+    // runs fn(i) for every i in [0, count) in chunks of grain and returns when
+    // all are done. The calling thread works on chunks too, so this is safe
+    // to call from inside a task and finishes alone if every worker is busy.
+    // fn is called through a plain function pointer and the batch state is
+    // recycled, so once every thread has been through a parallel_for at each
+    // nesting depth this doesn't allocate.
+    template<class F>
+    void parallel_for(u64 count, F&& fn, u64 grain = 1);
+
+    ParallelBatch* acquire_batch();
+    void release_batch(ParallelBatch* batch);
+
+    // takes batch out of open_batches, under mutex
+    void close_batch(ParallelBatch* batch);
+
+    void worker_loop();
+};
+
+// shared pool for the game, created on first use
+ThreadPool& job_pool() {
+    static ThreadPool pool;
+    return pool;
+}
+
+ThreadPool::ThreadPool(u32 thread_count) {
+    if (thread_count == 0) thread_count = std::max(1u, std::thread::hardware_concurrency());
+    // one parallel_for per thread at once without allocating, deeper
+    // nesting grows this on first use
+    for (u32 i = 0; i <= thread_count; ++i) {
+        batches.push_back(std::make_unique<ParallelBatch>());
+        free_batches.push_back(batches.back().get());
+    }
+    open_batches.reserve(batches.size());
+    workers.reserve(thread_count);
+    for (u32 i = 0; i < thread_count; ++i) {
+        workers.emplace_back(&ThreadPool::worker_loop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) worker.join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (task_count == tasks.size()) {
+            std::vector<std::function<void()>> grown(std::max<size_t>(16, tasks.size() * 2));
+            for (size_t i = 0; i < task_count; ++i) grown[i] = std::move(tasks[(task_head + i) % tasks.size()]);
+            tasks = std::move(grown);
+            task_head = 0;
+        }
+        tasks[(task_head + task_count) % tasks.size()] = std::move(task);
+        task_count++;
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::worker_loop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || task_count > 0 || !open_batches.empty(); });
+            if (!open_batches.empty()) {
+                // innermost first, its caller is the one blocking the others
+                ParallelBatch* batch = open_batches.back();
+                if (--batch->open_helpers == 0) open_batches.pop_back();
+                {
+                    std::lock_guard<std::mutex> batch_lock(batch->mutex);
+                    batch->running_helpers++;
+                }
+                lock.unlock();
+                batch->run_chunks();
+                std::lock_guard<std::mutex> batch_lock(batch->mutex);
+                batch->running_helpers--;
+                batch->done.notify_all();
+                continue;
+            }
+            if (task_count == 0) return;
+            task = std::move(tasks[task_head]);
+            tasks[task_head] = nullptr;
+            task_head = (task_head + 1) % tasks.size();
+            task_count--;
+        }
+        task();
+    }
+}
+
+void ParallelBatch::run_chunks() {
+    u64 chunk;
+    while ((chunk = next_chunk.fetch_add(1)) < chunk_count) {
+        fn(context, chunk * grain, std::min(count, (chunk + 1) * grain));
+        if (done_chunks.fetch_add(1) + 1 == chunk_count) {
+            std::lock_guard<std::mutex> lock(mutex);
+            done.notify_all();
+        }
+    }
+}
+
+ParallelBatch* ThreadPool::acquire_batch() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (free_batches.empty()) {
+        batches.push_back(std::make_unique<ParallelBatch>());
+        // release and open never have to grow theirs
+        free_batches.reserve(batches.size());
+        open_batches.reserve(batches.size());
+        return batches.back().get();
+    }
+    ParallelBatch* batch = free_batches.back();
+    free_batches.pop_back();
+    return batch;
+}
+
+void ThreadPool::release_batch(ParallelBatch* batch) {
+    std::lock_guard<std::mutex> lock(mutex);
+    free_batches.push_back(batch);
+}
+
+void ThreadPool::close_batch(ParallelBatch* batch) {
+    batch->open_helpers = 0;
+    auto it = std::find(open_batches.begin(), open_batches.end(), batch);
+    if (it != open_batches.end()) open_batches.erase(it);
+}
+
+template<class F>
+void ThreadPool::parallel_for(u64 count, F&& fn, u64 grain) {
+    if (count == 0) return;
+    grain = std::max<u64>(grain, 1);
+    u64 chunk_count = (count + grain - 1) / grain;
+    if (chunk_count == 1 || workers.empty()) {
+        for (u64 i = 0; i < count; ++i) fn(i);
+        return;
+    }
+
+    ParallelBatch* batch = acquire_batch();
+    u64 helpers = std::min<u64>(workers.size(), chunk_count - 1);
+    batch->next_chunk = 0;
+    batch->done_chunks = 0;
+    batch->count = count;
+    batch->chunk_count = chunk_count;
+    batch->grain = grain;
+    batch->context = (void*)&fn;
+    batch->fn = [](void* context, u64 begin, u64 end) {
+        std::remove_reference_t<F>& f = *(std::remove_reference_t<F>*)context;
+        for (u64 i = begin; i < end; ++i) f(i);
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        batch->open_helpers = (u32)helpers;
+        open_batches.push_back(batch);
+    }
+    for (u64 i = 0; i < helpers; ++i) wake.notify_one();
+    batch->run_chunks();
+
+    // helpers that didn't start by now aren't needed anymore
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        close_batch(batch);
+    }
+    {
+        std::unique_lock<std::mutex> lock(batch->mutex);
+        batch->done.wait(lock, [&] { return batch->done_chunks.load() == chunk_count && batch->running_helpers == 0; });
+    }
+    release_batch(batch);
+}
@@ -0,0 +1,380 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include "raylib.h"
+#include "common.hpp"
+
+// asynchronous logger. Callers copy the format pointer and binary encoded
+// arguments into a slot of a fixed ring and return, a background thread turns
+// them into text and does the I/O. A full ring drops the message and counts
+// it instead of waiting.
+//
+// Messages above LOG_MAX_LEVEL are compiled out, the rest are filtered at run
+// time per category.
+
+enum Log_Level : uint8_t {
+    NO_LOG, LOW, FULL,
+};
+
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL FULL
+#endif
+
+enum Log_Category : uint8_t {
+    LOG_GENERAL,
+    LOG_GAME,
+    LOG_LEVEL,
+    LOG_COMBAT,
+    LOG_IO,
+    LOG_GUI,
+    LOG_CATEGORY_MAX
+};
+
+static const char* LOG_CATEGORY_NAMES[LOG_CATEGORY_MAX] = {
+    "general", "game", "level", "combat", "io", "gui",
+};
+
+static const char* LOG_LEVEL_NAMES[] = {"", "LOW ", "FULL"};
+
+enum Log_Arg : uint8_t {
+    LOG_ARG_I64,
+    LOG_ARG_U64,
+    LOG_ARG_F64,
+    LOG_ARG_BOOL,
+    LOG_ARG_VEC2,
+    // u16 length then the bytes
+    LOG_ARG_STRING,
+    // std::string* the consumer deletes, for text too long for a slot
+    LOG_ARG_HEAP_STRING,
+};
+
+// one ring slot, two cache lines
+struct alignas(64) LogSlot {
+    std::atomic<u64> sequence = 0;
+    u64 time_ns = 0;
+    // must outlive the message, string literals in practice
+    const char* format = nullptr;
+    Log_Level level = NO_LOG;
+    Log_Category category = LOG_GENERAL;
+    uint8_t arg_count = 0;
+    bool truncated = false;
+    uint16_t payload_size = 0;
+    uint8_t payload[128 - 3 * sizeof(u64) - 6];
+};
+
+static_assert(sizeof(LogSlot) == 128);
+
+struct Logger {
+    static constexpr u64 CAPACITY = 4096;
+
+    // slot i is free for the producer at position p when sequence == p,
+    // readable for the consumer when sequence == p + 1
+    std::unique_ptr<LogSlot[]> slots;
+    std::atomic<u64> tail = 0;
+    u64 head = 0;
+    std::atomic<u64> dropped = 0;
+
+    std::atomic<Log_Level> category_level[LOG_CATEGORY_MAX];
+    std::atomic<FILE*> output = stdout;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::atomic<bool> stopping = false;
+    // consumer progress for flush
+    std::atomic<u64> written = 0;
+    // writer thread only, reserved up front so it doesn't allocate whenever
+    // the thread first gets scheduled
+    std::string line;
+
+    Logger();
+    ~Logger();
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    void set_level(Log_Level level) {
+        for (std::atomic<Log_Level>& category : category_level) category.store(level, std::memory_order_relaxed);
+    }
+
+    void set_level(Log_Category category, Log_Level level) { category_level[category].store(level, std::memory_order_relaxed); }
+
+    // nullptr discards, the file stays the caller's to close
+    void set_output(FILE* file) { output.store(file, std::memory_order_relaxed); }
+
+    bool enabled(Log_Level level, Log_Category category) const {
+        return level != NO_LOG && level <= category_level[category].load(std::memory_order_relaxed);
+    }
+
+    template<class... Args>
+    void push(Log_Level level, Log_Category category, const char* format, const Args&... args);
+
+    // blocks until everything pushed before the call is written
+    void flush();
+
+    // "{}" in format takes the next argument
+    void format_slot(const LogSlot& slot, std::string& line) const;
+
+    void writer_loop();
+    // returns false when the ring was empty
+    bool write_next();
+};
+
+Logger& logger() {
+    static Logger instance;
+    return instance;
+}
+
+static void log_encode(LogSlot& slot, const void* data, size_t size, Log_Arg type) {
+    if (slot.truncated || slot.payload_size + 1 + size > sizeof(slot.payload)) {
+        slot.truncated = true;
+        return;
+    }
+    slot.payload[slot.payload_size++] = type;
+    memcpy(slot.payload + slot.payload_size, data, size);
+    slot.payload_size += size;
+    slot.arg_count++;
+}
+
+static void log_encode_string(LogSlot& slot, std::string_view text) {
+    size_t header = 1 + sizeof(uint16_t);
+    if (!slot.truncated && slot.payload_size + header + text.size() <= sizeof(slot.payload)) {
+        uint16_t length = (uint16_t)text.size();
+        slot.payload[slot.payload_size++] = LOG_ARG_STRING;
+        memcpy(slot.payload + slot.payload_size, &length, sizeof(length));
+        memcpy(slot.payload + slot.payload_size + sizeof(length), text.data(), length);
+        slot.payload_size += sizeof(length) + length;
+        slot.arg_count++;
+        return;
+    }
+    // off the fast path, only big reports end up here
+    std::string* copy = new std::string(text);
+    log_encode(slot, &copy, sizeof(copy), LOG_ARG_HEAP_STRING);
+    if (slot.truncated) delete copy;
+}
+
+template<class T>
+static void log_encode_arg(LogSlot& slot, const T& value) {
+    if constexpr (std::is_same_v<T, bool>) {
+        log_encode(slot, &value, sizeof(value), LOG_ARG_BOOL);
+    } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+        int64_t v = value;
+        log_encode(slot, &v, sizeof(v), LOG_ARG_I64);
+    } else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) {
+        u64 v = (u64)value;
+        log_encode(slot, &v, sizeof(v), LOG_ARG_U64);
+    } else if constexpr (std::is_floating_point_v<T>) {
+        double v = value;
+        log_encode(slot, &v, sizeof(v), LOG_ARG_F64);
+    } else if constexpr (std::is_same_v<T, Vector2>) {
+        log_encode(slot, &value, sizeof(value), LOG_ARG_VEC2);
+    } else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+        log_encode_string(slot, std::string_view(value));
+    } else {
+        static_assert(sizeof(T) == 0, "no log encoding for this type");
+    }
+}
+
+template<class... Args>
+void Logger::push(Log_Level level, Log_Category category, const char* format, const Args&... args) {
+    u64 position = tail.load(std::memory_order_relaxed);
+    LogSlot* slot;
+    while (true) {
+        slot = &slots[position % CAPACITY];
+        u64 sequence = slot->sequence.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)sequence - (int64_t)position;
+        if (diff == 0) {
+            if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            position = tail.load(std::memory_order_relaxed);
+        }
+    }
+    slot->time_ns = (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    slot->format = format;
+    slot->level = level;
+    slot->category = category;
+    slot->arg_count = 0;
+    slot->truncated = false;
+    slot->payload_size = 0;
+    (log_encode_arg(*slot, args), ...);
+    slot->sequence.store(position + 1, std::memory_order_release);
+}
+
+Logger::Logger() : slots(new LogSlot[CAPACITY]) {
+    for (u64 i = 0; i < CAPACITY; ++i) slots[i].sequence.store(i, std::memory_order_relaxed);
+    for (std::atomic<Log_Level>& category : category_level) category.store(LOG_MAX_LEVEL, std::memory_order_relaxed);
+    line.reserve(256);
+    writer = std::thread(&Logger::writer_loop, this);
+}
+
+Logger::~Logger() {
+    stopping.store(true);
+    wake.notify_one();
+    writer.join();
+}
+
+void Logger::flush() {
+    u64 target = tail.load();
+    std::unique_lock<std::mutex> lock(mutex);
+    wake.notify_one();
+    wake.wait(lock, [&] { return written.load() >= target; });
+}
+
+bool Logger::write_next() {
+    LogSlot& slot = slots[head % CAPACITY];
+    if (slot.sequence.load(std::memory_order_acquire) != head + 1) return false;
+    format_slot(slot, line);
+    slot.sequence.store(head + CAPACITY, std::memory_order_release);
+    head++;
+
+    FILE* file = output.load(std::memory_order_relaxed);
+    if (file) fwrite(line.data(), 1, line.size(), file);
+    return true;
+}
+
+void Logger::writer_loop() {
+    while (true) {
+        bool any = false;
+        while (write_next()) any = true;
+        u64 dropped_now = dropped.exchange(0, std::memory_order_relaxed);
+        FILE* file = output.load(std::memory_order_relaxed);
+        if (dropped_now > 0 && file) fprintf(file, "[logger] dropped %llu messages, ring full\n", (unsigned long long)dropped_now);
+        if (any && file) fflush(file);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        written.store(head);
+        wake.notify_all();
+        if (stopping.load() && head == tail.load()) return;
+        // producers never notify, polling keeps push free of syscalls
+        wake.wait_for(lock, std::chrono::milliseconds(2));
+    }
+}
+
+void Logger::format_slot(const LogSlot& slot, std::string& line) const {
+    char buffer[64];
+    line.clear();
+    snprintf(buffer, sizeof(buffer), "[%10.4f] %s %-7s ", slot.time_ns / 1e9, LOG_LEVEL_NAMES[slot.level],
+             LOG_CATEGORY_NAMES[slot.category]);
+    line += buffer;
+
+    size_t offset = 0;
+    uint8_t args_left = slot.arg_count;
+    for (const char* c = slot.format; *c; ++c) {
+        if (c[0] != '{' || c[1] != '}') {
+            line += *c;
+            continue;
+        }
+        c++;
+        if (args_left == 0) {
+            line += slot.truncated ? "<truncated>" : "{}";
+            continue;
+        }
+        args_left--;
+        Log_Arg type = (Log_Arg)slot.payload[offset++];
+        const uint8_t* data = slot.payload + offset;
+        switch (type) {
+        case LOG_ARG_I64: {
+            int64_t v; memcpy(&v, data, sizeof(v)); offset += sizeof(v);
+            snprintf(buffer, sizeof(buffer), "%lld", (long long)v);
+            line += buffer;
+        } break;
+        case LOG_ARG_U64: {
+            u64 v; memcpy(&v, data, sizeof(v)); offset += sizeof(v);
+            snprintf(buffer, sizeof(buffer), "%llu", (unsigned long long)v);
+            line += buffer;
+        } break;
+        case LOG_ARG_F64: {
+            double v; memcpy(&v, data, sizeof(v)); offset += sizeof(v);
+            snprintf(buffer, sizeof(buffer), "%g", v);
+            line += buffer;
+        } break;
+        case LOG_ARG_BOOL: {
+            bool v; memcpy(&v, data, sizeof(v)); offset += sizeof(v);
+            line += v ? "true" : "false";
+        } break;
+        case LOG_ARG_VEC2: {
+            Vector2 v; memcpy(&v, data, sizeof(v)); offset += sizeof(v);
+            snprintf(buffer, sizeof(buffer), "(%g, %g)", v.x, v.y);
+            line += buffer;
+        } break;
+        case LOG_ARG_STRING: {
+            uint16_t length; memcpy(&length, data, sizeof(length));
+            line.append((const char*)data + sizeof(length), length);
+            offset += sizeof(length) + length;
+        } break;
+        case LOG_ARG_HEAP_STRING: {
+            std::string* text; memcpy(&text, data, sizeof(text)); offset += sizeof(text);
+            line += *text;
+            delete text;
+        } break;
+        }
+    }
+    // arguments without a {} still own their heap strings
+    for (; args_left > 0; --args_left) {
+        Log_Arg type = (Log_Arg)slot.payload[offset++];
+        const uint8_t* data = slot.payload + offset;
+        switch (type) {
+        case LOG_ARG_I64: offset += sizeof(int64_t); break;
+        case LOG_ARG_U64: offset += sizeof(u64); break;
+        case LOG_ARG_F64: offset += sizeof(double); break;
+        case LOG_ARG_BOOL: offset += sizeof(bool); break;
+        case LOG_ARG_VEC2: offset += sizeof(Vector2); break;
+        case LOG_ARG_STRING: {
+            uint16_t length; memcpy(&length, data, sizeof(length));
+            offset += sizeof(length) + length;
+        } break;
+        case LOG_ARG_HEAP_STRING: {
+            std::string* text; memcpy(&text, data, sizeof(text)); offset += sizeof(text);
+            delete text;
+        } break;
+        }
+    }
+    line += '\n';
+}
+
+// compiled out above LOG_MAX_LEVEL, argument types decide the encoding
+template<Log_Level LEVEL, class... Args>
+void log_message(Log_Category category, const char* format, const Args&... args) {
+    if constexpr (LEVEL == NO_LOG || LEVEL > LOG_MAX_LEVEL) {
+        return;
+    } else {
+        Logger& log = logger();
+        if (!log.enabled(LEVEL, category)) return;
+        log.push(LEVEL, category, format, args...);
+    }
+}
+
+template<class... Args>
+void log_low(Log_Category category, const char* format, const Args&... args) {
+    log_message<LOW>(category, format, args...);
+}
+
+template<class... Args>
+void log_full(Log_Category category, const char* format, const Args&... args) {
+    log_message<FULL>(category, format, args...);
+}
+
+// old style dump of one value, now through the ring like everything else
+template <class T>
+void log_var(const T& var, const char* name = nullptr, Log_Level log_lvl = FULL) {
+    if (log_lvl == LOW) {
+        if (name && strlen(name) > 0) log_low(LOG_GENERAL, "{}:\n{}", name, var);
+        else log_low(LOG_GENERAL, "{}", var);
+    } else if (log_lvl == FULL) {
+        if (name && strlen(name) > 0) log_full(LOG_GENERAL, "{}:\n{}", name, var);
+        else log_full(LOG_GENERAL, "{}", var);
+    }
+}
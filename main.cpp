@@ -6,22 +6,27 @@
 #include "game.hpp"
 #include "draw.hpp"
 #include "gui.hpp"
+#include "hot_reload.hpp"
+#include "autosave.hpp"
+#include "waves.hpp"
 
 
 
-Level make_test_level(const Window& window, Image img) {
-    Level level = Level("test", window.get_game_boundary());
+// the map can be far bigger than the window, the camera scrolls over it
+Level make_test_level(Rectangle bounds) {
+    Level level = Level("test", bounds);
+    Map& map = level.edit_map();
     int point_count = 50;
     for (int i = 0; i < point_count; ++i) {
-        level.map.waypoints.push_back({(float)i * window.width / (float)point_count, (float)i * window.height / (float)point_count});
+        map.waypoints.push_back({(float)i * bounds.width / (float)point_count, (float)i * bounds.height / (float)point_count});
         if (GetRandomValue(0, 2) == 0) {
             if (GetRandomValue(0, 1) == 1)
-                level.map.waypoints[i].x += GetRandomValue(1, 20);
+                map.waypoints[i].x += GetRandomValue(1, 20);
             else if (GetRandomValue(0, 1) == 1)
-                level.map.waypoints[i].y += GetRandomValue(1, 20);
+                map.waypoints[i].y += GetRandomValue(1, 20);
         }
     }
-    level.map.ground_tex_from_image(img);
+    map.ground_seed = GetRandomValue(0, 1 << 30);
 
     //EnemySpawner sp;
     //sp.position = {window.width / 2.f, 0};
@@ -35,35 +40,21 @@ Level make_test_level(const Window& window, Image img) {
     //sp.position = {100, 100};
     //level.spawners.push_back(sp);
 
-    Tower tower; tower.position = {window.width / 2.f, window.height / 1.7f};
+    Tower tower; tower.position = {bounds.width / 2.f, bounds.height / 1.7f};
     tower.type = TOWER_BASIC;
-    tower.turn_speed = .1f;
     level.add_tower(tower);
-    tower.position = {window.width - 100.f, window.height / 1.1f};
+    tower.position = {bounds.width - 100.f, bounds.height / 1.1f};
     level.add_tower(tower);
-    tower.position = {window.width / 2.f + 50, window.height / 1.6f};
+    tower.position = {bounds.width / 2.f + 50, bounds.height / 1.6f};
     level.add_tower(tower);
-    tower.position = {window.width - 50.f, window.height / 1.1f};
+    tower.position = {bounds.width - 50.f, bounds.height / 1.1f};
     level.add_tower(tower);
-    tower.position = {window.width / 2.f + 100, window.height / 1.6f};
+    tower.position = {bounds.width / 2.f + 100, bounds.height / 1.6f};
     level.add_tower(tower);
 
-    Round round;
-    round.length = 100; 
-    SpawnEvent event;
-    event.position = {window.width / 2.f, window.height / 2.f};
-    event.start = 0.f;
-    event.delay = .5f;
-    
-    for (int i = 0; i < ENEMY_TYPE_MAX; i++) {
-        event.enemies[i] = 100;
-    }
-    round.events.push_back(event);
-    //event.start = 2;
-    //round.events.push_back(event);
-    //event.start = 20;
-    //round.events.push_back(event);
-    level.rounds.push_back(round);
+    // see waves.hpp, -w plays a wave file instead
+    const char* waves = TextFormat("round 100\nat 0 pos %f %f delay 0.5 chicken 100\n", bounds.width / 2.f, bounds.height / 2.f);
+    if (!compile_waves(waves, "test level", level.rounds)) log_low(LOG_GAME, "test level has no rounds, its waves don't compile");
 
     return level;
 }
@@ -99,24 +90,30 @@ Menu make_main_menu(const Window& window) {
     // WARNING: memory leak (never freed)
 
     Button* start_button = new Button(); 
-    start_button->text = "Start";
+    start_button->set_text("Start");
     start_button->on_click = start_callback;
     start_button->boundary = {0, 0, 100, 100};
 
     Button* exit_button = new Button();
-    exit_button->text = "Exit";
+    exit_button->set_text("Exit");
     exit_button->on_click = exit_callback;
 
     menu.items.push_back(start_button);
     menu.items.push_back(exit_button);
 
     TextBox* textbox = new TextBox();
-    textbox->text = "I am TextBox";
+    textbox->set_text("I am TextBox");
     menu.items.push_back(textbox);
     menu.layout_vertical();
     return menu;
 }
 
+// which menus the game state calls for, the gui skips the rest
+void update_menu_visibility(Gui& gui, const Game& game) {
+    // not started game yet
+    gui.set_visible(MENU_MAIN, game.active_level == -1);
+}
+
 Gui make_gui(const Window& window) {
     Gui gui;
     Menu main_menu = make_main_menu(window);
@@ -125,44 +122,97 @@ Gui make_gui(const Window& window) {
     return gui;
 }
 
-int main() {
+int main(int argc, char** argv) {
+    // -m <width>x<height> for a map bigger than the window, up to 16384 a side.
+    // -w <waves.txt> replaces the rounds of every level, see waves.hpp.
+    // Level files given are played instead of the test level and reloaded
+    // whenever they are saved
+    Rectangle map_bounds = window.get_game_boundary();
+    std::vector<std::string> level_files;
+    const char* wave_file = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        int map_width = 0, map_height = 0;
+        if (strcmp(argv[i], "-m") == 0 && i + 1 < argc && sscanf(argv[++i], "%dx%d", &map_width, &map_height) == 2) {
+            map_bounds.width = (float)std::clamp(map_width, 1, 16384);
+            map_bounds.height = (float)std::clamp(map_height, 1, 16384);
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            wave_file = argv[++i];
+        } else if (argv[i][0] != '-') {
+            level_files.push_back(argv[i]);
+        } else {
+            fprintf(stderr, "usage: %s [-m <width>x<height>] [-w waves.txt] [level.blob ...]\n", argv[0]);
+            return 1;
+        }
+    }
+
     Log_Level global_log_lvl = FULL;
+    logger().set_level(global_log_lvl);
     SetRandomSeed(time(NULL));
 
-    const char* img_path = "perlin_noise.bmp";
-    Image img = LoadImage(img_path);
     // Raylib window
     window.set_fps(100);
     window.open();
 
-    Level test_lvl = make_test_level(window, img);
-    game.levels.push_back(test_lvl);
+    if (level_files.empty()) game.levels.push_back(make_test_level(map_bounds));
+    else game.load_levels(level_files);
+    std::vector<Round> rounds;
+    if (wave_file && load_waves(wave_file, rounds)) {
+        for (Level& level : game.levels) {
+            level.rounds = rounds;
+            level.mark_dirty(section_bit(SECTION_ROUNDS));
+        }
+    }
+    LevelReloader reloader;
+    reloader.watch(game);
+    // the level being played or edited, load it with Level::from_file
+    Autosave autosave("autosave.blob");
     //game.start();
     //game.get_current_level().load_from_file("level.blob");
     //
 
     Gui gui = make_gui(window);
+    alloc_tracker().claim_phases();
 
     while (!WindowShouldClose()) {
         window.resize_if_needed();
 
-        GameController::update(game);
+        {
+            AllocPhaseScope phase(PHASE_INPUT);
+            GameController::update(game);
+        }
+
+        // between ticks, nothing is running on the levels
+        reloader.update(game);
 
-        if (!(game.active_level == -1) || !game.paused) {
+        if (game.simulate_all || !(game.active_level == -1) || !game.paused) {
             game.update();
         }
-        gui.update();
+        if (game.edit_mode) autosave.update(game.edit_level, GetFrameTime());
+        else if (game.active_level != -1 && !game.simulate_all) autosave.update(game.get_current_level(), GetFrameTime());
+        {
+            AllocPhaseScope phase(PHASE_GUI);
+            update_menu_visibility(gui, game);
+            gui.update();
+        }
 
         if (game.quit) break; 
 
-        BeginDrawing();
-        ClearBackground(BLACK);
-         
-        window.draw(game, gui);
+        {
+            AllocPhaseScope phase(PHASE_DRAW);
+            BeginDrawing();
+            ClearBackground(BLACK);
+
+            window.draw(game, gui);
 
-        DrawFPS(0, initial_height / 2.f);
+            DrawFPS(0, initial_height / 2.f);
 
-        EndDrawing();
+            EndDrawing();
+        }
+#if ALLOC_TRACKING
+        alloc_tracker().end_frame();
+#endif
+        // nothing holds frame memory past the frame
+        reset_frame_arena();
     }
 
     window.close();
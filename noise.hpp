@@ -0,0 +1,222 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+#include "raylib.h"
+#include "raymath.h"
+#include "common.hpp"
+
+// procedural ground textures: perlin noise summed over octaves (fbm)
+
+struct NoiseParams {
+    u32 seed = 0;
+    int octaves = 5;
+    // cycles per pixel of the first octave
+    float frequency = 1.f / 128.f;
+    float persistence = 0.5f;
+    float lacunarity = 2.f;
+    Color low = {76, 63, 47, 255};
+    Color high = {160, 134, 96, 255};
+};
+
+struct PerlinNoise {
+    int perm[512];
+
+    PerlinNoise(u32 seed);
+
+    float sample(float x, float y) const;
+
+    // adds one octave for a run of pixels on the same row to out
+    void add_row(float* out, int count, float x0, float step, float y, float amplitude) const;
+};
+
+// fills rows [row_begin, row_end) of a width wide RGBA buffer. Pixel (x, y)
+// samples the noise at origin + (x, y) * scale, so pieces of a larger image can
+// be generated on their own and at lower resolution
+void gen_noise_rows(Color* pixels, int width, int row_begin, int row_end, const NoiseParams& params,
+                    float origin_x = 0.f, float origin_y = 0.f, float scale = 1.f);
+
+// thread_count = 0 => one thread per core
+Image gen_noise_image(int width, int height, const NoiseParams& params, u32 thread_count = 0);
+
+// size x size pixels of the image gen_noise_image would make, starting at
+// origin, one pixel every scale pixels. Single threaded, meant for the job pool
+Image gen_noise_tile(float origin_x, float origin_y, int size, float scale, const NoiseParams& params);
+
+
+static constexpr float GRAD_X[8] = {1.f, -1.f, 1.f, -1.f, 1.f, -1.f, 0.f, 0.f};
+static constexpr float GRAD_Y[8] = {1.f, 1.f, -1.f, -1.f, 0.f, 0.f, 1.f, -1.f};
+
+static inline float noise_fade(float t) {
+    return t * t * t * (t * (t * 6.f - 15.f) + 10.f);
+}
+
+PerlinNoise::PerlinNoise(u32 seed) {
+    Rng rng(seed);
+    for (int i = 0; i < 256; ++i) perm[i] = i;
+    for (int i = 255; i > 0; --i) {
+        int j = rng.next() % (i + 1);
+        std::swap(perm[i], perm[j]);
+    }
+    for (int i = 0; i < 256; ++i) perm[256 + i] = perm[i];
+}
+
+float PerlinNoise::sample(float x, float y) const {
+    float fx = floorf(x);
+    float fy = floorf(y);
+    int xi = (int)fx & 255;
+    int yi = (int)fy & 255;
+    x -= fx;
+    y -= fy;
+
+    int h00 = perm[perm[xi] + yi] & 7;
+    int h10 = perm[perm[xi + 1] + yi] & 7;
+    int h01 = perm[perm[xi] + yi + 1] & 7;
+    int h11 = perm[perm[xi + 1] + yi + 1] & 7;
+
+    float n00 = GRAD_X[h00] * x         + GRAD_Y[h00] * y;
+    float n10 = GRAD_X[h10] * (x - 1.f) + GRAD_Y[h10] * y;
+    float n01 = GRAD_X[h01] * x         + GRAD_Y[h01] * (y - 1.f);
+    float n11 = GRAD_X[h11] * (x - 1.f) + GRAD_Y[h11] * (y - 1.f);
+
+    float u = noise_fade(x);
+    float v = noise_fade(y);
+    float nx0 = n00 + u * (n10 - n00);
+    float nx1 = n01 + u * (n11 - n01);
+    return nx0 + v * (nx1 - nx0);
+}
+
+// The row is processed in blocks, split into a scalar pass for the hash table
+// lookups and branch free passes over flat float arrays the compiler can vectorize.
+void PerlinNoise::add_row(float* out, int count, float x0, float step, float y, float amplitude) const {
+    constexpr int BLOCK = 64;
+    float fy = floorf(y);
+    int yi = (int)fy & 255;
+    float yf = y - fy;
+    float v = noise_fade(yf);
+
+    int   xi[BLOCK];
+    float xf[BLOCK];
+    float g0x[BLOCK], g0y[BLOCK], g1x[BLOCK], g1y[BLOCK];
+    float g2x[BLOCK], g2y[BLOCK], g3x[BLOCK], g3y[BLOCK];
+
+    for (int start = 0; start < count; start += BLOCK) {
+        int n = std::min(BLOCK, count - start);
+
+        for (int i = 0; i < n; ++i) {
+            float x = x0 + (float)(start + i) * step;
+            float fx = floorf(x);
+            xi[i] = (int)fx & 255;
+            xf[i] = x - fx;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            int a = perm[xi[i]] + yi;
+            int b = perm[xi[i] + 1] + yi;
+            int h00 = perm[a] & 7, h01 = perm[a + 1] & 7;
+            int h10 = perm[b] & 7, h11 = perm[b + 1] & 7;
+            g0x[i] = GRAD_X[h00]; g0y[i] = GRAD_Y[h00];
+            g1x[i] = GRAD_X[h10]; g1y[i] = GRAD_Y[h10];
+            g2x[i] = GRAD_X[h01]; g2y[i] = GRAD_Y[h01];
+            g3x[i] = GRAD_X[h11]; g3y[i] = GRAD_Y[h11];
+        }
+
+        float* dst = out + start;
+        for (int i = 0; i < n; ++i) {
+            float x = xf[i];
+            float n00 = g0x[i] * x         + g0y[i] * yf;
+            float n10 = g1x[i] * (x - 1.f) + g1y[i] * yf;
+            float n01 = g2x[i] * x         + g2y[i] * (yf - 1.f);
+            float n11 = g3x[i] * (x - 1.f) + g3y[i] * (yf - 1.f);
+            float u = x * x * x * (x * (x * 6.f - 15.f) + 10.f);
+            float nx0 = n00 + u * (n10 - n00);
+            float nx1 = n01 + u * (n11 - n01);
+            dst[i] += amplitude * (nx0 + v * (nx1 - nx0));
+        }
+    }
+}
+
+void gen_noise_rows(Color* pixels, int width, int row_begin, int row_end, const NoiseParams& params,
+                    float origin_x, float origin_y, float scale) {
+    PerlinNoise noise(params.seed);
+    std::vector<float> row(width);
+
+    float amplitude_sum = 0.f;
+    float amplitude = 1.f;
+    for (int o = 0; o < params.octaves; ++o) {
+        amplitude_sum += amplitude;
+        amplitude *= params.persistence;
+    }
+    float norm = amplitude_sum > 0.f ? 1.f / amplitude_sum : 0.f;
+
+    for (int y = row_begin; y < row_end; ++y) {
+        std::fill(row.begin(), row.end(), 0.f);
+        float frequency = params.frequency;
+        amplitude = 1.f;
+        for (int o = 0; o < params.octaves; ++o) {
+            // finer than a pixel it would only alias, zoomed out tiles skip it
+            if (frequency * scale > 0.5f) break;
+            // shift every octave so the lattice points don't line up
+            float offset = (float)o * 17.31f;
+            noise.add_row(row.data(), width, origin_x * frequency + offset, frequency * scale,
+                          (origin_y + (float)y * scale) * frequency + offset, amplitude);
+            frequency *= params.lacunarity;
+            amplitude *= params.persistence;
+        }
+
+        Color* dst = pixels + (size_t)y * width;
+        for (int x = 0; x < width; ++x) {
+            float t = Clamp(row[x] * norm + 0.5f, 0.f, 1.f);
+            dst[x].r = (unsigned char)(params.low.r + t * (params.high.r - params.low.r));
+            dst[x].g = (unsigned char)(params.low.g + t * (params.high.g - params.low.g));
+            dst[x].b = (unsigned char)(params.low.b + t * (params.high.b - params.low.b));
+            dst[x].a = 255;
+        }
+    }
+}
+
+Image gen_noise_image(int width, int height, const NoiseParams& params, u32 thread_count) {
+    Image img = {};
+    if (width <= 0 || height <= 0) return img;
+
+    img.data = MemAlloc((unsigned int)((size_t)width * height * sizeof(Color)));
+    img.width = width;
+    img.height = height;
+    img.mipmaps = 1;
+    img.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
+    Color* pixels = (Color*)img.data;
+
+    if (thread_count == 0) thread_count = std::max(1u, std::thread::hardware_concurrency());
+    thread_count = std::min<u32>(thread_count, height);
+
+    if (thread_count == 1) {
+        gen_noise_rows(pixels, width, 0, height, params);
+        return img;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count);
+    int rows_per_thread = (height + thread_count - 1) / thread_count;
+    for (u32 t = 0; t < thread_count; ++t) {
+        int begin = t * rows_per_thread;
+        int end = std::min(height, begin + rows_per_thread);
+        if (begin >= end) break;
+        threads.emplace_back(gen_noise_rows, pixels, width, begin, end, std::cref(params), 0.f, 0.f, 1.f);
+    }
+    for (std::thread& thread : threads) thread.join();
+
+    return img;
+}
+
+Image gen_noise_tile(float origin_x, float origin_y, int size, float scale, const NoiseParams& params) {
+    Image img = {};
+    if (size <= 0) return img;
+    img.data = MemAlloc((unsigned int)((size_t)size * size * sizeof(Color)));
+    img.width = size;
+    img.height = size;
+    img.mipmaps = 1;
+    img.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
+    gen_noise_rows((Color*)img.data, size, 0, size, params, origin_x, origin_y, scale);
+    return img;
+}
@@ -0,0 +1,157 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "raylib.h"
+#include "raymath.h"
+#include "common.hpp"
+
+// enemies bucketed by the path segment they're on. Segment k ends at waypoint k,
+// segment 0 is the way from the spawn to the first waypoint. Counts change only
+// when an enemy spawns, passes a waypoint or goes away, the spread and the
+// leader are refreshed by the enemy update pass.
+struct PathBucket {
+    u32 count = 0;
+    // squared distance to the segment's waypoint of the enemies closest to and
+    // farthest from it, squared so the update pass needs no sqrt
+    float nearest_sq = 0.f;
+    float farthest_sq = 0.f;
+    // id of the enemy at nearest_sq
+    u32 leader = 0;
+};
+
+struct PathProgress {
+    // path length from waypoint 0 to waypoint k
+    std::vector<float> waypoint_distance;
+    std::vector<PathBucket> buckets;
+    // fenwick tree over bucket counts for the near-exit queries
+    std::vector<u32> count_tree;
+    u32 total = 0;
+    // highest bucket with enemies in it, only valid while total > 0
+    u32 last_occupied = 0;
+
+    // drops every count, the caller adds the enemies back
+    void build(const std::vector<Vector2>& waypoints);
+
+    size_t waypoint_count() const { return waypoint_distance.size(); }
+
+    float get_path_length() const { return waypoint_distance.empty() ? 0.f : waypoint_distance.back(); }
+
+    void add(u32 segment, u32 count = 1);
+    void remove(u32 segment);
+    void move(u32 from, u32 to);
+
+    // forget last tick's spread, then record every live enemy
+    void begin_pass();
+    void record(u32 segment, Vector2 position, const std::vector<Vector2>& waypoints, u32 id);
+
+    // distance along the path, negative before the first waypoint
+    float get_progress(u32 segment, Vector2 position, const std::vector<Vector2>& waypoints) const;
+
+    float get_min_progress(u32 segment) const { return waypoint_distance[segment] - sqrtf(buckets[segment].farthest_sq); }
+    float get_max_progress(u32 segment) const { return waypoint_distance[segment] - sqrtf(buckets[segment].nearest_sq); }
+
+    bool empty() const { return total == 0; }
+
+    // O(1), only valid when !empty()
+    u32 get_leader() const { return buckets[last_occupied].leader; }
+    float get_leader_distance_to_exit() const { return get_path_length() - get_max_progress(last_occupied); }
+
+    // enemies within distance of the exit, O(log n) at segment resolution: the
+    // segment the threshold falls into only counts if all of it is past it
+    u32 count_near_exit(float distance) const;
+
+    // enemies on segments [0, segment)
+    u32 count_before(u32 segment) const;
+
+    void tree_add(u32 segment, int delta);
+};
+
+void PathProgress::build(const std::vector<Vector2>& waypoints) {
+    waypoint_distance.resize(waypoints.size());
+    float length = 0.f;
+    for (size_t i = 0; i < waypoints.size(); ++i) {
+        if (i > 0) length += Vector2Distance(waypoints[i - 1], waypoints[i]);
+        waypoint_distance[i] = length;
+    }
+    buckets.assign(waypoints.size(), PathBucket());
+    count_tree.assign(waypoints.size() + 1, 0);
+    total = 0;
+    last_occupied = 0;
+}
+
+void PathProgress::tree_add(u32 segment, int delta) {
+    for (u32 i = segment + 1; i < count_tree.size(); i += i & (0u - i)) count_tree[i] += delta;
+}
+
+u32 PathProgress::count_before(u32 segment) const {
+    u32 count = 0;
+    for (u32 i = std::min<u32>(segment, (u32)count_tree.size() - 1); i > 0; i -= i & (0u - i)) count += count_tree[i];
+    return count;
+}
+
+void PathProgress::add(u32 segment, u32 count) {
+    if (segment >= buckets.size() || count == 0) return;
+    PathBucket& bucket = buckets[segment];
+    if (bucket.count == 0) {
+        // nothing recorded yet, keeps the queries sane until the next pass by
+        // putting everyone at the start of the segment
+        float length = segment > 0 ? waypoint_distance[segment] - waypoint_distance[segment - 1] : 0.f;
+        bucket.nearest_sq = length * length;
+        bucket.farthest_sq = length * length;
+    }
+    bucket.count += count;
+    total += count;
+    tree_add(segment, (int)count);
+    if (total == count || segment > last_occupied) last_occupied = segment;
+}
+
+void PathProgress::remove(u32 segment) {
+    if (segment >= buckets.size() || buckets[segment].count == 0) return;
+    buckets[segment].count--;
+    total--;
+    tree_add(segment, -1);
+    // amortized O(1), the leader only ever walks back over emptied buckets
+    while (last_occupied > 0 && buckets[last_occupied].count == 0) last_occupied--;
+}
+
+void PathProgress::move(u32 from, u32 to) {
+    if (from == to) return;
+    add(to);
+    remove(from);
+}
+
+void PathProgress::begin_pass() {
+    for (PathBucket& bucket : buckets) {
+        bucket.nearest_sq = INFINITY;
+        bucket.farthest_sq = 0.f;
+    }
+}
+
+void PathProgress::record(u32 segment, Vector2 position, const std::vector<Vector2>& waypoints, u32 id) {
+    if (segment >= buckets.size()) return;
+    PathBucket& bucket = buckets[segment];
+    float remaining_sq = Vector2DistanceSqr(position, waypoints[segment]);
+    bucket.farthest_sq = std::max(bucket.farthest_sq, remaining_sq);
+    if (remaining_sq < bucket.nearest_sq) {
+        bucket.nearest_sq = remaining_sq;
+        bucket.leader = id;
+    }
+}
+
+float PathProgress::get_progress(u32 segment, Vector2 position, const std::vector<Vector2>& waypoints) const {
+    if (segment >= waypoints.size()) return get_path_length();
+    return waypoint_distance[segment] - Vector2Distance(position, waypoints[segment]);
+}
+
+u32 PathProgress::count_near_exit(float distance) const {
+    if (total == 0) return 0;
+    float threshold = get_path_length() - distance;
+    // first waypoint at or past the threshold, segments after it are all in
+    u32 first = (u32)(std::lower_bound(waypoint_distance.begin(), waypoint_distance.end(), threshold) - waypoint_distance.begin());
+    if (first >= buckets.size()) return 0;
+    u32 count = total - count_before(first + 1);
+    const PathBucket& straddling = buckets[first];
+    if (straddling.count > 0 && get_min_progress(first) >= threshold) count += straddling.count;
+    return count;
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "raylib.h"
+#include "raymath.h"
+#include "common.hpp"
+
+// uniform grid over points, rebuilt from scratch with a counting sort whenever
+// the points move. Cells hold indices into the array it was built from. Points
+// outside bounds land in the border cells so queries never miss them.
+struct SpatialGrid {
+    Rectangle bounds = {0.f, 0.f, 0.f, 0.f};
+    float cell_size = 32.f;
+    u32 columns = 0;
+    u32 rows = 0;
+    // largest half size of the items around their points, see for_each_overlapping
+    Vector2 padding = {0.f, 0.f};
+
+    // items of cell c are items[cell_start[c] .. cell_start[c + 1])
+    std::vector<u32> cell_start;
+    std::vector<u32> items;
+    std::vector<Vector2> points;
+    // build scratch
+    std::vector<u32> item_cell;
+    std::vector<u32> cursor;
+
+    void build(Rectangle bounds, float cell_size, const Vector2* points, u32 count, Vector2 padding);
+
+    u32 cell_x(float x) const;
+    u32 cell_y(float y) const;
+
+    // fn(index) for every point in the cells rec touches, candidates only
+    template<class F>
+    void for_each_in_rect(Rectangle rec, F&& fn) const;
+
+    // fn(index) for every item whose box, point +- padding, may overlap rec
+    template<class F>
+    void for_each_overlapping(Rectangle rec, F&& fn) const;
+
+    // fn(index) for every point within radius of center
+    template<class F>
+    void for_each_in_radius(Vector2 center, float radius, F&& fn) const;
+};
+
+void SpatialGrid::build(Rectangle bounds, float cell_size, const Vector2* points, u32 count, Vector2 padding) {
+    this->bounds = bounds;
+    this->cell_size = cell_size;
+    this->padding = padding;
+    columns = std::max(1u, (u32)ceilf(bounds.width / cell_size));
+    rows = std::max(1u, (u32)ceilf(bounds.height / cell_size));
+
+    this->points.assign(points, points + count);
+    item_cell.resize(count);
+    cell_start.assign((size_t)columns * rows + 1, 0);
+    for (u32 i = 0; i < count; ++i) {
+        u32 cell = cell_y(points[i].y) * columns + cell_x(points[i].x);
+        item_cell[i] = cell;
+        cell_start[cell + 1]++;
+    }
+    for (size_t c = 1; c < cell_start.size(); ++c) cell_start[c] += cell_start[c - 1];
+
+    items.resize(count);
+    cursor.assign(cell_start.begin(), cell_start.end() - 1);
+    for (u32 i = 0; i < count; ++i) items[cursor[item_cell[i]]++] = i;
+}
+
+// clamped first so the cast truncates like floorf, which is a libm call
+// without sse4.1 and showed up as most of the build time
+u32 SpatialGrid::cell_x(float x) const {
+    return (u32)std::clamp((x - bounds.x) / cell_size, 0.f, (float)(columns - 1));
+}
+
+u32 SpatialGrid::cell_y(float y) const {
+    return (u32)std::clamp((y - bounds.y) / cell_size, 0.f, (float)(rows - 1));
+}
+
+template<class F>
+void SpatialGrid::for_each_in_rect(Rectangle rec, F&& fn) const {
+    if (items.empty()) return;
+    u32 x0 = cell_x(rec.x), x1 = cell_x(rec.x + rec.width);
+    u32 y0 = cell_y(rec.y), y1 = cell_y(rec.y + rec.height);
+    for (u32 y = y0; y <= y1; ++y) {
+        const u32* start = cell_start.data() + (size_t)y * columns;
+        for (u32 i = start[x0]; i < start[x1 + 1]; ++i) fn(items[i]);
+    }
+}
+
+template<class F>
+void SpatialGrid::for_each_overlapping(Rectangle rec, F&& fn) const {
+    rec.x -= padding.x;
+    rec.y -= padding.y;
+    rec.width += 2.f * padding.x;
+    rec.height += 2.f * padding.y;
+    for_each_in_rect(rec, fn);
+}
+
+template<class F>
+void SpatialGrid::for_each_in_radius(Vector2 center, float radius, F&& fn) const {
+    float radius_sq = radius * radius;
+    Rectangle rec = {center.x - radius, center.y - radius, 2.f * radius, 2.f * radius};
+    for_each_in_rect(rec, [&](u32 i) {
+        float dx = points[i].x - center.x;
+        float dy = points[i].y - center.y;
+        if (dx * dx + dy * dy <= radius_sq) fn(i);
+    });
+}
@@ -0,0 +1,247 @@
+#pragma once
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+#include "raylib.h"
+#include "common.hpp"
+#include "game.hpp"
+
+// rounds written as text instead of filled in by hand. One command a line,
+// # starts a comment:
+//
+//   round <length>
+//   at <start> [pos <x> <y>] [delay <seconds>] [repeat <n> every <seconds> [grow <count>]] <type> <count> ...
+//
+// at adds a spawn event to the last round, <type> is a name from
+// ENEMY_TYPE_NAMES and may come more than once. delay is the time between two
+// enemies of the event, 0 spawns them all at once. repeat n puts n copies of
+// the event every seconds apart, each one grow enemies of every listed type
+// bigger than the one before. pos and delay carry over to the next at of the
+// same round, so a run of waves from one place only names it once. Numbers
+// have to be finite, an event holds at most WAVE_MAX_ENEMIES of a type:
+//
+//   round 120
+//   at 0  pos 600 0 delay 0.5 chicken 20
+//   at 30 repeat 6 every 10 grow 5 chicken 10
+//
+// compile_waves expands the repeats and sorts every round by start, which is
+// what Round::update walks. load_waves keeps that table as a binary file next
+// to the source and only compiles again when the source changed.
+
+static constexpr u32 WAVE_CACHE_MAGIC = 0x45564157; // "WAVE"
+static constexpr u32 WAVE_CACHE_VERSION = 1;
+// a typo in repeat or a count shouldn't take all the memory
+static constexpr u64 WAVE_MAX_REPEAT = 100000;
+// enemies of one type in one event, grow included
+static constexpr u64 WAVE_MAX_ENEMIES = 1000000;
+
+// false with a log line naming source and the line if the text doesn't parse,
+// rounds holds what compiled up to there
+bool compile_waves(std::string_view text, const char* source, std::vector<Round>& rounds);
+
+// rounds of the wave file, from file_name + ".bin" if that was compiled from
+// the file as it is now. Otherwise compiles and rewrites the cache
+bool load_waves(const char* file_name, std::vector<Round>& rounds);
+
+static std::string_view next_wave_token(std::string_view& line) {
+    size_t start = line.find_first_not_of(" \t\r");
+    if (start == std::string_view::npos) {
+        line = {};
+        return {};
+    }
+    size_t end = line.find_first_of(" \t\r", start);
+    if (end == std::string_view::npos) end = line.size();
+    std::string_view token = line.substr(start, end - start);
+    line.remove_prefix(end);
+    return token;
+}
+
+template<class T>
+static bool parse_wave_number(std::string_view token, T& out) {
+    if (token.empty()) return false;
+    // from_chars doesn't take a leading +
+    if (token[0] == '+') token.remove_prefix(1);
+    auto [end, error] = std::from_chars(token.data(), token.data() + token.size(), out);
+    if (error != std::errc() || end != token.data() + token.size()) return false;
+    // from_chars reads nan and inf, a nan start would break the sort
+    if constexpr (std::is_floating_point_v<T>) return std::isfinite(out);
+    return true;
+}
+
+static int find_enemy_type(std::string_view name) {
+    for (int i = 0; i < ENEMY_TYPE_MAX; ++i) {
+        if (name == ENEMY_TYPE_NAMES[i]) return i;
+    }
+    return -1;
+}
+
+bool compile_waves(std::string_view text, const char* source, std::vector<Round>& rounds) {
+    rounds.clear();
+    Vector2 position = {0.f, 0.f};
+    float delay = 0.f;
+    u32 line_number = 0;
+
+    auto fail = [&](const char* what, std::string_view token) {
+        log_low(LOG_IO, "{}:{}: {} '{}'", source, line_number, what, token);
+        return false;
+    };
+
+    while (!text.empty()) {
+        ++line_number;
+        size_t line_end = text.find('\n');
+        std::string_view line = text.substr(0, line_end);
+        text.remove_prefix(line_end == std::string_view::npos ? text.size() : line_end + 1);
+        line = line.substr(0, line.find('#'));
+
+        std::string_view command = next_wave_token(line);
+        if (command.empty()) continue;
+
+        if (command == "round") {
+            std::string_view token = next_wave_token(line);
+            Round round;
+            if (!parse_wave_number(token, round.length) || round.length < 0.f) return fail("bad round length", token);
+            rounds.push_back(std::move(round));
+            position = {0.f, 0.f};
+            delay = 0.f;
+        } else if (command == "at") {
+            if (rounds.empty()) return fail("wave before the first round", command);
+            SpawnEvent event = {};
+            u64 repeat = 1, grow = 0;
+            float every = 0.f;
+            std::string_view token = next_wave_token(line);
+            if (!parse_wave_number(token, event.start) || event.start < 0.f) return fail("bad start time", token);
+
+            for (token = next_wave_token(line); !token.empty(); token = next_wave_token(line)) {
+                if (token == "pos") {
+                    std::string_view x = next_wave_token(line), y = next_wave_token(line);
+                    if (!parse_wave_number(x, position.x) || !parse_wave_number(y, position.y)) return fail("bad position", token);
+                } else if (token == "delay") {
+                    token = next_wave_token(line);
+                    if (!parse_wave_number(token, delay) || delay < 0.f) return fail("bad delay", token);
+                } else if (token == "repeat") {
+                    token = next_wave_token(line);
+                    if (!parse_wave_number(token, repeat) || repeat == 0 || repeat > WAVE_MAX_REPEAT) return fail("bad repeat count", token);
+                } else if (token == "every") {
+                    token = next_wave_token(line);
+                    if (!parse_wave_number(token, every) || every < 0.f) return fail("bad repeat interval", token);
+                } else if (token == "grow") {
+                    token = next_wave_token(line);
+                    if (!parse_wave_number(token, grow) || grow > WAVE_MAX_ENEMIES) return fail("bad grow count", token);
+                } else {
+                    int type = find_enemy_type(token);
+                    if (type < 0) return fail("unknown enemy type", token);
+                    std::string_view count = next_wave_token(line);
+                    u64 enemies = 0;
+                    if (!parse_wave_number(count, enemies) || enemies > WAVE_MAX_ENEMIES - event.enemies[type]) return fail("bad enemy count", count);
+                    event.enemies[type] += enemies;
+                }
+            }
+            event.position = position;
+            event.delay = delay;
+            for (u64 count : event.enemies) {
+                if (count > 0 && count + (repeat - 1) * grow > WAVE_MAX_ENEMIES) return fail("too many enemies after grow", command);
+            }
+            if (!std::isfinite(event.start + every * (float)(repeat - 1))) return fail("repeats run past any time", command);
+
+            std::vector<SpawnEvent>& events = rounds.back().events;
+            events.reserve(events.size() + repeat);
+            for (u64 i = 0; i < repeat; ++i) {
+                events.push_back(event);
+                event.start += every;
+                for (u64& count : event.enemies) {
+                    if (count > 0) count += grow;
+                }
+            }
+        } else {
+            return fail("unknown command", command);
+        }
+    }
+
+    for (Round& round : rounds) {
+        std::stable_sort(round.events.begin(), round.events.end(),
+                         [](const SpawnEvent& a, const SpawnEvent& b) { return a.start < b.start; });
+    }
+    return true;
+}
+
+static std::string wave_cache_name(const char* file_name) {
+    return std::string(file_name) + ".bin";
+}
+
+// what the cache header remembers of the source, false when it can't be read.
+// The stamp is in file clock ticks, which can be negative
+static bool get_wave_source_stamp(const char* file_name, int64_t& stamp, u64& size) {
+    std::error_code error;
+    std::filesystem::file_time_type mtime = std::filesystem::last_write_time(file_name, error);
+    if (error) return false;
+    size = std::filesystem::file_size(file_name, error);
+    if (error) return false;
+    stamp = (int64_t)mtime.time_since_epoch().count();
+    return true;
+}
+
+static bool load_wave_cache(const char* cache_name, int64_t stamp, u64 source_size, std::vector<Round>& rounds) {
+    int total_size = 0;
+    byte* blob = (byte*)LoadFileData(cache_name, &total_size);
+    if (!blob) return false;
+    size_t offset = 0;
+    blob_read_end = (size_t)total_size;
+    u32 magic = 0, version = 0;
+    int64_t cached_stamp = 0;
+    u64 cached_size = 0;
+    read_from_blob(blob, offset, magic);
+    read_from_blob(blob, offset, version);
+    read_from_blob(blob, offset, cached_stamp);
+    read_from_blob(blob, offset, cached_size);
+    bool fresh = magic == WAVE_CACHE_MAGIC && version == WAVE_CACHE_VERSION && cached_stamp == stamp && cached_size == source_size;
+    if (fresh) struct_array_from_blob(blob, offset, rounds);
+    UnloadFileData(blob);
+    blob_read_end = SIZE_MAX;
+    return fresh && offset == (size_t)total_size;
+}
+
+static void save_wave_cache(const char* cache_name, int64_t stamp, u64 source_size, const std::vector<Round>& rounds) {
+    size_t total_size = sizeof(WAVE_CACHE_MAGIC) + sizeof(WAVE_CACHE_VERSION) + sizeof(stamp) + sizeof(source_size);
+    total_size += sizeof(size_t);
+    for (const Round& round : rounds) total_size += round.get_byte_size();
+    std::vector<byte> blob(total_size);
+    size_t offset = 0;
+    write_to_blob(blob.data(), offset, WAVE_CACHE_MAGIC);
+    write_to_blob(blob.data(), offset, WAVE_CACHE_VERSION);
+    write_to_blob(blob.data(), offset, stamp);
+    write_to_blob(blob.data(), offset, source_size);
+    struct_array_to_blob(blob.data(), offset, rounds);
+    assert(offset == total_size);
+    // a torn write fails the size check on load and gets compiled again
+    if (!SaveFileData(cache_name, blob.data(), (int)total_size)) log_low(LOG_IO, "could not write {}", cache_name);
+}
+
+bool load_waves(const char* file_name, std::vector<Round>& rounds) {
+    int64_t stamp = 0;
+    u64 source_size = 0;
+    if (!get_wave_source_stamp(file_name, stamp, source_size)) {
+        log_low(LOG_IO, "could not read {}", file_name);
+        return false;
+    }
+    std::string cache_name = wave_cache_name(file_name);
+    if (load_wave_cache(cache_name.c_str(), stamp, source_size, rounds)) return true;
+
+    char* text = LoadFileText(file_name);
+    if (!text) {
+        log_low(LOG_IO, "could not read {}", file_name);
+        return false;
+    }
+    bool ok = compile_waves(std::string_view(text, strlen(text)), file_name, rounds);
+    UnloadFileText(text);
+    if (!ok) return false;
+    save_wave_cache(cache_name.c_str(), stamp, source_size, rounds);
+    log_full(LOG_IO, "compiled {} into {}", file_name, cache_name);
+    return true;
+}